@@ -0,0 +1,364 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+/**
+ * Synthetic workload generator. Emits a trace of @nr_ops records following
+ * one of the access patterns below. The trace is written in the binary
+ * format by default so that the simulator replays it without parsing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "trace.h"
+
+static unsigned long nr_ops = 1000000;
+static unsigned int nr_pages = 4096;
+static unsigned int huge_page_size = 0;	/* Pages are not huge if 0 */
+static unsigned int write_ratio = 30;	/* in percent */
+static double zipf_theta = 0.99;
+static unsigned int nr_processes = 8;
+static unsigned int quantum = 8;
+static unsigned int nr_trace_cpus = 1;
+static uint64_t seed = 1;
+
+static struct trace_writer writer;
+static FILE *text_output = NULL;
+static unsigned long nr_emitted = 0;
+
+/**
+ * xorshift64*. The same seed always gives the same trace.
+ */
+static inline uint64_t __random(void)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return seed * 0x2545f4914f6cdd1dULL;
+}
+
+static inline double __random_double(void)
+{
+	return (__random() >> 11) * (1.0 / (1ULL << 53));
+}
+
+static bool __emit(unsigned int opcode, unsigned int flags, unsigned int arg)
+{
+	struct trace_record record = {
+		.opcode = opcode,
+		.flags = flags,
+		.arg = arg,
+	};
+
+	if (nr_emitted >= nr_ops) return false;
+	nr_emitted++;
+
+	if (!text_output) {
+		if (!append_trace(&writer, &record)) {
+			fprintf(stderr, "Unable to write the trace\n");
+			exit(EXIT_FAILURE);
+		}
+		return true;
+	}
+
+	switch (opcode) {
+	case TRACE_ACCESS:
+		fprintf(text_output, "%s %u\n", flags == RW_WRITE ? "write" : "read", arg);
+		break;
+	case TRACE_ALLOC:
+		fprintf(text_output, "alloc %u %s\n", arg, flags & RW_WRITE ? "rw" : "r");
+		break;
+	case TRACE_ALLOC_HUGE:
+		fprintf(text_output, "hugealloc %u %s\n", arg, flags & RW_WRITE ? "rw" : "r");
+		break;
+	case TRACE_FREE:
+		fprintf(text_output, "free %u\n", arg);
+		break;
+	case TRACE_SWITCH:
+		fprintf(text_output, "switch %u\n", arg);
+		break;
+	case TRACE_CPU:
+		fprintf(text_output, "cpu %u\n", arg);
+		break;
+	case TRACE_KILL:
+		fprintf(text_output, "kill %u\n", arg);
+		break;
+	}
+	return true;
+}
+
+static bool __access(unsigned int vpn)
+{
+	bool write = __random() % 100 < write_ratio;
+
+	return __emit(TRACE_ACCESS, write ? RW_WRITE : RW_READ, vpn);
+}
+
+static bool __populate(void)
+{
+	if (huge_page_size) {
+		for (unsigned int vpn = 0; vpn < nr_pages; vpn += huge_page_size) {
+			if (!__emit(TRACE_ALLOC_HUGE, RW_READ | RW_WRITE, vpn)) return false;
+		}
+		return true;
+	}
+
+	for (unsigned int vpn = 0; vpn < nr_pages; vpn++) {
+		if (!__emit(TRACE_ALLOC, RW_READ | RW_WRITE, vpn)) return false;
+	}
+	return true;
+}
+
+
+static void __gen_sequential(void)
+{
+	for (unsigned long i = 0; __access(i % nr_pages); i++);
+}
+
+static void __gen_uniform(void)
+{
+	while (__access(__random() % nr_pages));
+}
+
+/**
+ * Zipfian distribution over the pages, following the generator of Gray et
+ * al., "Quickly generating billion-record synthetic databases". Page 0 is
+ * the hottest one.
+ */
+static void __gen_zipf(void)
+{
+	double zetan = 0, zeta2 = 1 + pow(0.5, zipf_theta);
+	double alpha = 1.0 / (1.0 - zipf_theta);
+	double eta;
+
+	for (unsigned int i = 1; i <= nr_pages; i++) {
+		zetan += 1.0 / pow(i, zipf_theta);
+	}
+	eta = (1 - pow(2.0 / nr_pages, 1 - zipf_theta)) / (1 - zeta2 / zetan);
+
+	while (true) {
+		double u = __random_double();
+		double uz = u * zetan;
+		unsigned int vpn;
+
+		if (uz < 1) {
+			vpn = 0;
+		} else if (uz < zeta2) {
+			vpn = 1;
+		} else {
+			vpn = nr_pages * pow(eta * u - eta + 1, alpha);
+			if (vpn >= nr_pages) vpn = nr_pages - 1;
+		}
+		if (!__access(vpn)) break;
+	}
+}
+
+/**
+ * Fork a child from process 0 over and over. Each child reads a page and
+ * gives the CPU back to the parent, which reaps the child.
+ */
+static void __gen_fork_storm(void)
+{
+	for (unsigned int pid = 1; ; pid++) {
+		if (!__emit(TRACE_SWITCH, 0, pid)) break;
+		if (!__emit(TRACE_ACCESS, RW_READ, __random() % nr_pages)) break;
+		if (!__emit(TRACE_SWITCH, 0, 0)) break;
+		if (!__emit(TRACE_KILL, 0, pid)) break;
+	}
+}
+
+/**
+ * Each child writes to a run of pages shared with the parent, which copies
+ * the pages, and frees them before switching back to the parent. Thus the
+ * number of page frames in use stays bounded.
+ */
+static void __gen_cow_storm(void)
+{
+	unsigned int nr_writes = nr_pages < 16 ? nr_pages : 16;
+
+	for (unsigned int pid = 1; ; pid++) {
+		unsigned int start = __random() % nr_pages;
+
+		if (!__emit(TRACE_SWITCH, 0, pid)) return;
+		for (unsigned int i = 0; i < nr_writes; i++) {
+			if (!__emit(TRACE_ACCESS, RW_WRITE, (start + i) % nr_pages)) return;
+		}
+		for (unsigned int i = 0; i < nr_writes; i++) {
+			if (!__emit(TRACE_FREE, 0, (start + i) % nr_pages)) return;
+		}
+		if (!__emit(TRACE_SWITCH, 0, 0)) return;
+	}
+}
+
+/**
+ * @nr_processes processes forked from process 0 take turns to access random
+ * pages for @quantum times. The turns go to @nr_trace_cpus CPUs in turn, and
+ * there are more processes than the CPUs so that the process to run next is
+ * not running on another CPU.
+ */
+static void __gen_round_robin(void)
+{
+	for (unsigned int pid = 1; pid < nr_processes; pid++) {
+		if (!__emit(TRACE_SWITCH, 0, pid)) return;
+	}
+
+	for (unsigned long turn = 0; ; turn++) {
+		if (nr_trace_cpus > 1 && !__emit(TRACE_CPU, 0, turn % nr_trace_cpus)) return;
+		/* Switching to the current process forks a new one */
+		if (nr_processes > 1 && !__emit(TRACE_SWITCH, 0, turn % nr_processes)) return;
+
+		for (unsigned int i = 0; i < quantum; i++) {
+			if (!__access(__random() % nr_pages)) return;
+		}
+	}
+}
+
+static const struct pattern {
+	const char *name;
+	void (*generate)(void);
+	const char *description;
+} patterns[] = {
+	{ "seq", __gen_sequential, "Access the pages sequentially" },
+	{ "uniform", __gen_uniform, "Access the pages uniformly at random" },
+	{ "zipf", __gen_zipf, "Access the pages following the Zipfian distribution" },
+	{ "fork", __gen_fork_storm, "Fork children from a process repeatedly" },
+	{ "cow", __gen_cow_storm, "Write to the pages shared with the parent" },
+	{ "rr", __gen_round_robin, "Run processes in the round-robin manner" },
+	{ NULL },
+};
+
+static void __print_usage(const char *name)
+{
+	printf("Usage: %s -p pattern {-n ops} {-m pages} {-H size} {-w ratio} {-z theta} {-P processes} {-q quantum} {-C cpus} {-r seed} {-t} {output}\n", name);
+	printf("\n");
+	printf("  -p: Access pattern\n");
+	for (const struct pattern *p = patterns; p->name; p++) {
+		printf("      %-8s %s\n", p->name, p->description);
+	}
+	printf("  -n: Number of records in the trace (default: %lu)\n", nr_ops);
+	printf("  -m: Number of pages allocated before the accesses (default: %u)\n", nr_pages);
+	printf("  -H: Allocate the pages in huge pages of @size pages, which should be\n");
+	printf("      the huge page size of the simulator (default: no huge page)\n");
+	printf("  -w: Percentage of writes among the accesses (default: %u)\n", write_ratio);
+	printf("  -z: Skew of the Zipfian distribution (default: %.2f)\n", zipf_theta);
+	printf("  -P: Number of processes for rr (default: %u)\n", nr_processes);
+	printf("  -q: Number of accesses in each turn for rr (default: %u)\n", quantum);
+	printf("  -C: Number of CPUs to run rr, less than the processes (default: %u)\n", nr_trace_cpus);
+	printf("  -r: Random seed (default: %llu)\n", (unsigned long long)seed);
+	printf("  -t: Write the text workload instead of the binary trace. The workload\n");
+	printf("      goes to stdout if no output is given\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const struct pattern *pattern = NULL;
+	bool text = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hp:n:m:H:w:z:P:q:C:r:t")) != -1) {
+		switch (opt) {
+		case 'p':
+			for (pattern = patterns; pattern->name; pattern++) {
+				if (strcmp(pattern->name, optarg) == 0) break;
+			}
+			if (!pattern->name) {
+				fprintf(stderr, "Unknown pattern %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			nr_ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			nr_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			huge_page_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write_ratio = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			zipf_theta = strtod(optarg, NULL);
+			break;
+		case 'P':
+			nr_processes = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			quantum = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			nr_trace_cpus = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			text = true;
+			break;
+		case 'h':
+		default:
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!pattern) {
+		__print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (nr_pages == 0 || nr_processes == 0 || seed == 0 ||
+			zipf_theta <= 0 || zipf_theta >= 1 || nr_trace_cpus == 0 ||
+			(nr_trace_cpus > 1 && nr_trace_cpus >= nr_processes) ||
+			nr_trace_cpus > MAX_CPUS) {
+		fprintf(stderr, "Invalid parameters for the pattern\n");
+		return EXIT_FAILURE;
+	}
+
+	if (text) {
+		text_output = argv[optind] ? fopen(argv[optind], "w") : stdout;
+		if (!text_output) {
+			fprintf(stderr, "Unable to create %s\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+	} else {
+		if (!argv[optind]) {
+			fprintf(stderr, "The binary trace needs the output file\n");
+			return EXIT_FAILURE;
+		}
+		if (!create_trace(&writer, argv[optind])) {
+			fprintf(stderr, "Unable to create trace %s\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (__populate()) pattern->generate();
+
+	if (text_output) {
+		if (text_output != stdout) fclose(text_output);
+	} else if (!close_trace(&writer)) {
+		fprintf(stderr, "Unable to write trace %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
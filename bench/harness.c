@@ -0,0 +1,136 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+/**
+ * Benchmark harness. Runs the simulator command for a number of times, and
+ * reports the throughput and the peak memory usage of the simulator. The
+ * number of operations is taken from the binary trace given as the last
+ * argument of the command.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "types.h"
+#include "trace.h"
+
+static double __now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * __run(@argv, @elapsed, @maxrss)
+ *
+ * DESCRIPTION
+ *   Run @argv to the completion, and get the wall-clock time in @elapsed and
+ *   the peak resident set size in KB in @maxrss.
+ *
+ * RETURN
+ *   @true if the command exits successfully
+ */
+static bool __run(char *argv[], double *elapsed, long *maxrss)
+{
+	struct rusage usage;
+	double start = __now();
+	int status;
+	pid_t pid = fork();
+
+	if (pid < 0) return false;
+	if (pid == 0) {
+		execv(argv[0], argv);
+		fprintf(stderr, "Unable to execute %s\n", argv[0]);
+		_exit(EXIT_FAILURE);
+	}
+
+	if (wait4(pid, &status, 0, &usage) < 0) return false;
+
+	*elapsed = __now() - start;
+	*maxrss = usage.ru_maxrss;
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+static void __print_usage(const char *name)
+{
+	printf("Usage: %s {-r runs} {-n name} simulator {options} trace\n", name);
+	printf("\n");
+	printf("  -r: Number of runs. The fastest run is reported (default: 3)\n");
+	printf("  -n: Name of the benchmark in the report (default: trace)\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nr_runs = 3;
+	const char *name = NULL;
+	struct trace_map trace;
+	double best = 0;
+	long peak = 0;
+	int opt;
+
+	/* Stop at the simulator command so that its options are kept intact */
+	while ((opt = getopt(argc, argv, "+hr:n:")) != -1) {
+		switch (opt) {
+		case 'r':
+			nr_runs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		case 'h':
+		default:
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 2 || nr_runs == 0) {
+		__print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!map_trace(&trace, argv[argc - 1])) {
+		fprintf(stderr, "%s is not a binary trace\n", argv[argc - 1]);
+		return EXIT_FAILURE;
+	}
+	if (!name) name = argv[argc - 1];
+
+	for (unsigned int i = 0; i < nr_runs; i++) {
+		double elapsed;
+		long maxrss;
+
+		if (!__run(argv + optind, &elapsed, &maxrss)) {
+			fprintf(stderr, "%s failed\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+		if (i == 0 || elapsed < best) best = elapsed;
+		if (maxrss > peak) peak = maxrss;
+	}
+
+	printf("%-12s %10llu ops %8.3f s %12.0f ops/s %8.1f ns/op %8ld KB\n",
+			name, (unsigned long long)trace.nr_records, best,
+			trace.nr_records / best, best * 1e9 / trace.nr_records, peak);
+
+	unmap_trace(&trace);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,462 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "pagetable.h"
+#include "stats.h"
+#include "swap.h"
+#include "checkpoint.h"
+#include "vma.h"
+
+extern struct list_head processes;
+extern struct process *current;
+extern struct pagetable *ptbr;
+extern unsigned int *mapcounts;
+
+extern void restore_processes(struct process *procs, unsigned int nr_procs,
+		unsigned int nr_ready, unsigned long tlb_stamp);
+
+/**
+ * The processes and the page tables live in the checkpoint mapped last. It
+ * is unmapped when another checkpoint is restored over
+ */
+static void *mapped = NULL;
+static size_t mapped_size = 0;
+
+#define CHECKPOINT_ALIGN	8
+
+static inline uint64_t __align(uint64_t offset)
+{
+	return (offset + CHECKPOINT_ALIGN - 1) & ~(uint64_t)(CHECKPOINT_ALIGN - 1);
+}
+
+static inline unsigned int __nr_tlb_entries_per_cpu(void)
+{
+	return NR_TLB_ENTRIES + NR_HUGE_TLB_ENTRIES + NR_STLB_ENTRIES;
+}
+
+static bool __valid_header(const struct checkpoint_header *h)
+{
+	return memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+		h->version == CHECKPOINT_VERSION &&
+		h->header_size == sizeof(*h) &&
+		h->process_size == sizeof(struct process) &&
+		h->tlb_entry_size == sizeof(struct tlb_entry) &&
+		h->psc_entry_size == sizeof(struct psc_entry) &&
+		h->stats_size == sizeof(struct vm_stats);
+}
+
+static bool __same_geometry(const struct checkpoint_header *h)
+{
+	return h->nr_pageframes == nr_pageframes &&
+		h->ptes_per_page_shift == ptes_per_page_shift &&
+		h->nr_pt_levels == nr_pt_levels &&
+		h->nr_tlb_entries == nr_tlb_entries &&
+		h->nr_tlb_ways == nr_tlb_ways &&
+		h->nr_huge_tlb_entries == nr_huge_tlb_entries &&
+		h->nr_stlb_entries == nr_stlb_entries &&
+		h->nr_stlb_ways == nr_stlb_ways &&
+		h->nr_cpus == nr_cpus &&
+		h->nr_nodes == nr_nodes;
+}
+
+bool load_checkpoint_geometry(const char *path)
+{
+	struct checkpoint_header h;
+	FILE *file = fopen(path, "r");
+	bool ret;
+
+	if (!file) return false;
+
+	ret = fread(&h, sizeof(h), 1, file) == 1 && __valid_header(&h);
+	fclose(file);
+	if (!ret) return false;
+
+	nr_pageframes = h.nr_pageframes;
+	ptes_per_page_shift = h.ptes_per_page_shift;
+	nr_pt_levels = h.nr_pt_levels;
+	nr_tlb_entries = h.nr_tlb_entries;
+	nr_tlb_ways = h.nr_tlb_ways;
+	nr_huge_tlb_entries = h.nr_huge_tlb_entries;
+	nr_stlb_entries = h.nr_stlb_entries;
+	nr_stlb_ways = h.nr_stlb_ways;
+	nr_cpus = h.nr_cpus;
+	nr_nodes = h.nr_nodes;
+	return true;
+}
+
+static bool __write_at(FILE *file, uint64_t offset, const void *data, size_t size)
+{
+	return fseeko(file, offset, SEEK_SET) == 0 &&
+		(size == 0 || fwrite(data, size, 1, file) == 1);
+}
+
+bool save_checkpoint(const char *path)
+{
+	struct checkpoint_header h = {
+		.magic = CHECKPOINT_MAGIC,
+		.version = CHECKPOINT_VERSION,
+		.header_size = sizeof(h),
+		.process_size = sizeof(struct process),
+		.tlb_entry_size = sizeof(struct tlb_entry),
+		.psc_entry_size = sizeof(struct psc_entry),
+		.stats_size = sizeof(struct vm_stats),
+		.nr_pageframes = nr_pageframes,
+		.ptes_per_page_shift = ptes_per_page_shift,
+		.nr_pt_levels = nr_pt_levels,
+		.nr_tlb_entries = nr_tlb_entries,
+		.nr_tlb_ways = nr_tlb_ways,
+		.nr_huge_tlb_entries = nr_huge_tlb_entries,
+		.nr_stlb_entries = nr_stlb_entries,
+		.nr_stlb_ways = nr_stlb_ways,
+		.nr_cpus = nr_cpus,
+		.nr_nodes = nr_nodes,
+		.nr_psc_entries = nr_psc_entries,
+		.this_cpu = this_cpu,
+	};
+	struct process *procs, *p;
+	struct pagetable **pts;
+	struct checkpoint_vma *vmas;
+	unsigned int nr = 0;
+	char *tmp;
+	FILE *file;
+	bool ret;
+
+	if (replacement_policy) {
+		fprintf(stderr, "Unable to checkpoint while swapping\n");
+		return false;
+	}
+
+	/* Save the state of the running CPU to @cpus[] */
+	switch_cpu(this_cpu);
+
+	list_for_each_entry(p, &processes, list) nr++;
+	h.nr_ready = nr;
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		if (cpus[i].current) nr++;
+	}
+	h.nr_processes = nr;
+
+	procs = malloc(sizeof(*procs) * nr);
+	pts = malloc(sizeof(*pts) * nr);
+
+	nr = 0;
+	list_for_each_entry(p, &processes, list) procs[nr++] = *p;
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		h.running[i] = cpus[i].current ? nr : -1;
+		if (cpus[i].current) procs[nr++] = *cpus[i].current;
+	}
+	for (unsigned int i = 0; i < nr; i++) {
+		/* Linked again on restore */
+		memset(&procs[i].list, 0, sizeof(procs[i].list));
+		memset(&procs[i].hash, 0, sizeof(procs[i].hash));
+		pts[i] = &procs[i].pagetable;
+		h.nr_vmas += procs[i].vmas.nr_vmas;
+	}
+
+	/* The trees of the areas are built again on restore */
+	vmas = malloc(sizeof(*vmas) * (h.nr_vmas ? h.nr_vmas : 1));
+	h.nr_vmas = 0;
+	for (unsigned int i = 0; i < nr; i++) {
+		for (struct vma *vma = first_vma(&procs[i].vmas); vma; vma = next_vma(vma)) {
+			vmas[h.nr_vmas].start = vma->start;
+			vmas[h.nr_vmas].end = vma->end;
+			vmas[h.nr_vmas].prot = vma->prot;
+			h.nr_vmas++;
+		}
+		procs[i].vmas.root = NULL;
+	}
+
+	h.processes = __align(sizeof(h));
+	h.mapcounts = __align(h.processes + sizeof(*procs) * nr);
+	h.contents = __align(h.mapcounts + sizeof(*mapcounts) * NR_PAGEFRAMES);
+	h.tlbs = __align(h.contents + sizeof(*page_contents) * NR_PAGEFRAMES);
+	h.pscs = __align(h.tlbs + sizeof(struct tlb_entry) *
+			__nr_tlb_entries_per_cpu() * nr_cpus);
+	h.stats = __align(h.pscs + sizeof(struct psc_entry) * nr_psc_entries * nr_cpus);
+	h.vmas = __align(h.stats + sizeof(vm_stats));
+	h.pagetables.offset = __align(h.vmas + sizeof(*vmas) * h.nr_vmas);
+
+	/**
+	 * The restored state may live in the private mapping of @path, which
+	 * would be truncated under it. So the checkpoint is written aside and
+	 * renamed over @path, leaving the old file mapped until the next restore
+	 */
+	tmp = malloc(strlen(path) + sizeof(".tmp"));
+	sprintf(tmp, "%s.tmp", path);
+	if (!(file = fopen(tmp, "w"))) {
+		fprintf(stderr, "Unable to create checkpoint %s\n", path);
+		free(tmp);
+		free(vmas);
+		free(pts);
+		free(procs);
+		return false;
+	}
+
+	ret = fseeko(file, h.pagetables.offset, SEEK_SET) == 0 &&
+		save_pagetables(file, pts, nr, &h.pagetables);
+	h.size = h.pagetables.offset + h.pagetables.size;
+
+	ret = ret && __write_at(file, h.processes, procs, sizeof(*procs) * nr);
+	ret = ret && __write_at(file, h.mapcounts, mapcounts,
+			sizeof(*mapcounts) * NR_PAGEFRAMES);
+	ret = ret && __write_at(file, h.contents, page_contents,
+			sizeof(*page_contents) * NR_PAGEFRAMES);
+	for (unsigned int i = 0; i < nr_cpus && ret; i++) {
+		uint64_t offset = h.tlbs +
+				sizeof(struct tlb_entry) * __nr_tlb_entries_per_cpu() * i;
+
+		ret = __write_at(file, offset, cpus[i].tlb,
+				sizeof(struct tlb_entry) * NR_TLB_ENTRIES) &&
+			__write_at(file, offset + sizeof(struct tlb_entry) * NR_TLB_ENTRIES,
+				cpus[i].huge_tlb, sizeof(struct tlb_entry) * NR_HUGE_TLB_ENTRIES) &&
+			__write_at(file, offset + sizeof(struct tlb_entry) *
+					(NR_TLB_ENTRIES + NR_HUGE_TLB_ENTRIES),
+				cpus[i].stlb, sizeof(struct tlb_entry) * NR_STLB_ENTRIES);
+	}
+	for (unsigned int i = 0; i < nr_cpus && ret; i++) {
+		struct psc_entry *e = malloc(sizeof(*e) * (nr_psc_entries ? nr_psc_entries : 1));
+
+		/* Directories are looked up again on restore */
+		for (unsigned int j = 0; j < nr_psc_entries; j++) {
+			e[j] = cpus[i].psc[j];
+			e[j].pd = NULL;
+		}
+		ret = __write_at(file, h.pscs + sizeof(*e) * nr_psc_entries * i, e,
+				sizeof(*e) * nr_psc_entries);
+		free(e);
+	}
+	ret = ret && __write_at(file, h.stats, &vm_stats, sizeof(vm_stats));
+	ret = ret && __write_at(file, h.vmas, vmas, sizeof(*vmas) * h.nr_vmas);
+	ret = ret && __write_at(file, 0, &h, sizeof(h));
+
+	if (fclose(file) != 0) ret = false;
+	if (ret && rename(tmp, path) != 0) ret = false;
+	if (!ret) {
+		fprintf(stderr, "Unable to write checkpoint %s\n", path);
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(vmas);
+	free(pts);
+	free(procs);
+	return ret;
+}
+
+/* Areas of each process are in order, and in the address space */
+static bool __valid_vmas(const struct checkpoint_header *h)
+{
+	const struct process *procs =
+			(const struct process *)((const char *)h + h->processes);
+	const struct checkpoint_vma *vma =
+			(const struct checkpoint_vma *)((const char *)h + h->vmas);
+	uint64_t nr_vmas = 0;
+
+	if (h->vmas + sizeof(*vma) * h->nr_vmas > h->size) return false;
+
+	for (unsigned int i = 0; i < h->nr_processes; i++) {
+		uint32_t last = 0;
+
+		nr_vmas += procs[i].vmas.nr_vmas;
+		if (nr_vmas > h->nr_vmas) return false;
+
+		for (unsigned int j = 0; j < procs[i].vmas.nr_vmas; j++, vma++) {
+			if (vma->start < last || vma->start >= vma->end ||
+					vma->end > NR_VPNS || !vma->prot) {
+				return false;
+			}
+			last = vma->end;
+		}
+	}
+	return nr_vmas == h->nr_vmas;
+}
+
+static bool __valid_checkpoint(const struct checkpoint_header *h, size_t size)
+{
+	if (!__valid_header(h) || h->size > size) return false;
+
+	if (h->this_cpu >= h->nr_cpus || h->nr_ready > h->nr_processes) return false;
+	for (unsigned int i = 0; i < h->nr_cpus; i++) {
+		if (h->running[i] >= (int32_t)h->nr_processes) return false;
+	}
+
+	return h->processes + sizeof(struct process) * h->nr_processes <= h->size &&
+		h->mapcounts + sizeof(*mapcounts) * NR_PAGEFRAMES <= h->size &&
+		h->contents + sizeof(*page_contents) * NR_PAGEFRAMES <= h->size &&
+		h->tlbs + sizeof(struct tlb_entry) * __nr_tlb_entries_per_cpu() *
+			nr_cpus <= h->size &&
+		h->pscs + sizeof(struct psc_entry) * h->nr_psc_entries *
+			nr_cpus <= h->size &&
+		h->stats + sizeof(vm_stats) <= h->size &&
+		h->pagetables.offset + h->pagetables.size <= h->size &&
+		valid_pagetable_image(&h->pagetables) &&
+		__valid_vmas(h);
+}
+
+/* Find the cached directories of the paging-structure caches again */
+static void __restore_pscs(const struct checkpoint_header *h,
+		struct process *procs)
+{
+	const struct psc_entry *saved =
+			(const struct psc_entry *)((const char *)h + h->pscs);
+
+	psc_clock = 0;
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		memset(cpus[i].psc, 0, sizeof(*cpus[i].psc) * nr_psc_entries);
+		if (h->nr_psc_entries != nr_psc_entries) continue;
+
+		for (unsigned int j = 0; j < nr_psc_entries; j++) {
+			const struct psc_entry *e = saved + nr_psc_entries * i + j;
+			struct pte_directory *pd = NULL;
+			bool shared = true;
+
+			if (!e->valid) continue;
+
+			for (unsigned int k = 0; k < h->nr_processes && !pd; k++) {
+				if (procs[k].asid != e->asid) continue;
+
+				pd = lookup_pte_directory(&procs[k].pagetable,
+						e->index << PTES_PER_PAGE_SHIFT, &shared);
+			}
+			if (!pd || shared) continue;
+
+			cpus[i].psc[j] = *e;
+			cpus[i].psc[j].pd = pd;
+			if (e->stamp > psc_clock) psc_clock = e->stamp;
+		}
+	}
+}
+
+/* Build the trees of the areas of the processes again */
+static void __restore_vmas(const struct checkpoint_header *h,
+		struct process *procs)
+{
+	const struct checkpoint_vma *vma =
+			(const struct checkpoint_vma *)((const char *)h + h->vmas);
+
+	/* The areas of the processes restored over are dropped */
+	destroy_vmas();
+
+	for (unsigned int i = 0; i < h->nr_processes; i++) {
+		unsigned int nr_vmas = procs[i].vmas.nr_vmas;
+
+		procs[i].vmas.root = NULL;
+		procs[i].vmas.nr_vmas = 0;
+		for (unsigned int j = 0; j < nr_vmas; j++, vma++) {
+			map_vmas(&procs[i].vmas, vma->start, vma->end, vma->prot);
+		}
+	}
+}
+
+bool restore_checkpoint(const char *path)
+{
+	struct checkpoint_header *h;
+	struct process *procs;
+	struct pagetable **pts;
+	struct tlb_entry *tlbs;
+	unsigned long tlb_stamp = 0;
+	struct stat st;
+	void *base;
+	int fd;
+
+	if (replacement_policy) {
+		fprintf(stderr, "Unable to restore a checkpoint while swapping\n");
+		return false;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < sizeof(*h)) {
+		fprintf(stderr, "Unable to open checkpoint %s\n", path);
+		if (fd >= 0) close(fd);
+		return false;
+	}
+
+	/* Private writable mapping to fix up the pointers in place */
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Unable to map checkpoint %s\n", path);
+		return false;
+	}
+
+	h = base;
+	if (!__valid_checkpoint(h, st.st_size) || !__same_geometry(h)) {
+		fprintf(stderr, "Checkpoint %s is invalid or of another geometry\n", path);
+		munmap(base, st.st_size);
+		return false;
+	}
+
+	/* Come back to the CPU running at the checkpoint */
+	switch_cpu(h->this_cpu);
+
+	memcpy(mapcounts, (char *)base + h->mapcounts, sizeof(*mapcounts) * NR_PAGEFRAMES);
+	memcpy(page_contents, (char *)base + h->contents,
+			sizeof(*page_contents) * NR_PAGEFRAMES);
+	init_frames();
+
+	procs = (struct process *)((char *)base + h->processes);
+	pts = malloc(sizeof(*pts) * (h->nr_processes ? h->nr_processes : 1));
+	for (unsigned int i = 0; i < h->nr_processes; i++) {
+		pts[i] = &procs[i].pagetable;
+	}
+	restore_pagetables(base, &h->pagetables, pts, h->nr_processes);
+	free(pts);
+	__restore_vmas(h, procs);
+
+	tlbs = (struct tlb_entry *)((char *)base + h->tlbs);
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		struct tlb_entry *t = tlbs + __nr_tlb_entries_per_cpu() * i;
+
+		memcpy(cpus[i].tlb, t, sizeof(*t) * NR_TLB_ENTRIES);
+		memcpy(cpus[i].huge_tlb, t + NR_TLB_ENTRIES, sizeof(*t) * NR_HUGE_TLB_ENTRIES);
+		if (NR_STLB_ENTRIES) {
+			memcpy(cpus[i].stlb, t + NR_TLB_ENTRIES + NR_HUGE_TLB_ENTRIES,
+					sizeof(*t) * NR_STLB_ENTRIES);
+		}
+		/* The replacement policies may rank the entries by the clock too */
+		for (unsigned int j = 0; j < __nr_tlb_entries_per_cpu(); j++) {
+			if (t[j].stamp > tlb_stamp) tlb_stamp = t[j].stamp;
+			if (t[j].rank > tlb_stamp) tlb_stamp = t[j].rank;
+		}
+
+		cpus[i].current = h->running[i] < 0 ? NULL : procs + h->running[i];
+		cpus[i].ptbr = cpus[i].current ? &cpus[i].current->pagetable : NULL;
+	}
+	current = cpus[this_cpu].current;
+	ptbr = cpus[this_cpu].ptbr;
+
+	__restore_pscs(h, procs);
+
+	restore_processes(procs, h->nr_processes, h->nr_ready, tlb_stamp);
+	memcpy(&vm_stats, (char *)base + h->stats, sizeof(vm_stats));
+
+	if (mapped) munmap(mapped, mapped_size);
+	mapped = base;
+	mapped_size = st.st_size;
+	return true;
+}
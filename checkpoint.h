@@ -0,0 +1,124 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdint.h>
+
+#include "types.h"
+#include "vm.h"
+#include "pagetable.h"
+
+/**
+ * Checkpoint of the simulator. The file starts with struct checkpoint_header
+ * followed by the sections at the offsets in the header;
+ *
+ *   struct process [@nr_processes], of which the first @nr_ready ones are in
+ *     the ready queue in order, and the others are running on the CPUs
+ *   @mapcounts[] and @page_contents[] of the page frames
+ *   TLB, huge page TLB, and second-level TLB entries of each CPU
+ *   Paging-structure cache entries of each CPU, without the directories
+ *   struct vm_stats
+ *   struct checkpoint_vma [@nr_vmas], the areas of each process in order
+ *   Image of the page tables of the processes
+ *
+ * Pointers in the file are the offsets from the start of the file. A restore
+ * maps the file and turns the offsets into pointers in place, and the
+ * simulation goes on with the processes and the page tables in the mapped
+ * file.
+ */
+#define CHECKPOINT_MAGIC	"VMCKPT"
+#define CHECKPOINT_VERSION	6
+
+/**
+ * Area of a process. The areas of each process are in the ascending order,
+ * and the number of them is in @vmas of the process
+ */
+struct checkpoint_vma {
+	uint32_t start;
+	uint32_t end;
+	uint32_t prot;
+};
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t process_size;
+	uint32_t tlb_entry_size;
+	uint32_t psc_entry_size;
+	uint32_t stats_size;
+
+	/* Geometry of the system */
+	uint32_t nr_pageframes;
+	uint32_t ptes_per_page_shift;
+	uint32_t nr_pt_levels;
+	uint32_t nr_tlb_entries;
+	uint32_t nr_tlb_ways;
+	uint32_t nr_huge_tlb_entries;
+	uint32_t nr_stlb_entries;
+	uint32_t nr_stlb_ways;
+	uint32_t nr_cpus;
+	uint32_t nr_nodes;
+	uint32_t nr_psc_entries;	/* Restored only if the same */
+
+	uint32_t this_cpu;
+	uint32_t nr_processes;
+	uint32_t nr_ready;
+	uint32_t nr_vmas;
+	int32_t running[MAX_CPUS];	/* Process running on each CPU. -1 if idle */
+
+	uint64_t processes;
+	uint64_t mapcounts;
+	uint64_t contents;
+	uint64_t tlbs;
+	uint64_t pscs;
+	uint64_t stats;
+	uint64_t vmas;
+	struct pagetable_image pagetables;
+	uint64_t size;
+};
+
+/**
+ * load_checkpoint_geometry(@path)
+ *
+ * DESCRIPTION
+ *   Configure the memory geometry and the numbers of CPUs and memory nodes
+ *   as in the checkpoint @path. Called before the system is set up to
+ *   restore @path.
+ *
+ * RETURN
+ *   @true if @path is a checkpoint
+ */
+bool load_checkpoint_geometry(const char *path);
+
+/**
+ * save_checkpoint(@path)/restore_checkpoint(@path)
+ *
+ * DESCRIPTION
+ *   Save the state of the simulator to @path, or replace the state with
+ *   the checkpoint @path. The checkpoint should be of the same geometry.
+ *   Checkpoints are not supported while pages are swapped. @path is
+ *   replaced as a whole, so it can be the checkpoint restored last.
+ *
+ * RETURN
+ *   @true on success. Errors are reported to stderr
+ */
+bool save_checkpoint(const char *path);
+bool restore_checkpoint(const char *path);
+
+#endif
@@ -0,0 +1,355 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "slab.h"
+#include "stats.h"
+#include "swap.h"
+
+#define BITS_PER_WORD	64
+#define WORD_OF(bit)	((bit) / BITS_PER_WORD)
+#define MASK_OF(bit)	(1ULL << ((bit) % BITS_PER_WORD))
+
+extern unsigned int *mapcounts;
+extern struct process *current;
+
+/**
+ * Free page frames of each memory node are set in its bitmap, of which bit i
+ * stands for page frame (@first + i)
+ */
+static struct free_frames {
+	struct bitmap bitmap;
+	unsigned int first;
+	unsigned int nr_free;
+} *nodes = NULL;
+static unsigned int nr_free;
+
+enum numa_policy numa_policy = NUMA_LOCAL;
+
+/**
+ * Reverse map of each page frame
+ */
+struct rmap_item **rmaps = NULL;
+
+static struct slab_cache rmap_cache =
+		SLAB_CACHE_INIT("rmap", sizeof(struct rmap_item));
+
+struct page_content *page_contents = NULL;
+
+/**
+ * Page frames with @prefetched set in their contents
+ */
+static struct bitmap prefetched_frames;
+
+/**
+ * The number of huge PTEs among the mappings of each page frame. Swapping
+ * works on the regular PTEs, so the page frames mapped by any huge PTE are
+ * kept out of the replacement policy.
+ */
+static unsigned int *huge_mapcounts = NULL;
+
+static inline bool __evictable(unsigned int pfn)
+{
+	return mapcounts[pfn] && !huge_mapcounts[pfn];
+}
+
+static void __update_evictable(unsigned int pfn, bool was_evictable)
+{
+	if (!replacement_policy || __evictable(pfn) == was_evictable) return;
+
+	if (was_evictable) {
+		swap_page_removed(pfn);
+	} else {
+		swap_page_added(pfn);
+	}
+}
+
+
+void init_bitmap(struct bitmap *bitmap, unsigned int nr_bits, bool set)
+{
+	unsigned int nr_words = nr_bits;
+
+	bitmap->nr_bits = nr_bits;
+	bitmap->nr_levels = 0;
+
+	do {
+		nr_words = (nr_words + BITS_PER_WORD - 1) / BITS_PER_WORD;
+
+		assert(bitmap->nr_levels < BITMAP_MAX_LEVELS);
+		bitmap->levels[bitmap->nr_levels++] =
+				calloc(nr_words, sizeof(uint64_t));
+	} while (nr_words > 1);
+
+	if (!set) return;
+
+	for (unsigned int i = 0; i < nr_bits; i++) {
+		bitmap_set(bitmap, i);
+	}
+}
+
+void free_bitmap(struct bitmap *bitmap)
+{
+	for (unsigned int l = 0; l < bitmap->nr_levels; l++) {
+		free(bitmap->levels[l]);
+	}
+	bitmap->nr_levels = 0;
+}
+
+void bitmap_set(struct bitmap *bitmap, unsigned int bit)
+{
+	for (unsigned int l = 0; l < bitmap->nr_levels; l++) {
+		uint64_t *word = bitmap->levels[l] + WORD_OF(bit);
+		bool was_empty = (*word == 0);
+
+		*word |= MASK_OF(bit);
+
+		/* Upper levels already know this word has a set bit */
+		if (!was_empty) break;
+		bit = WORD_OF(bit);
+	}
+}
+
+void bitmap_clear(struct bitmap *bitmap, unsigned int bit)
+{
+	for (unsigned int l = 0; l < bitmap->nr_levels; l++) {
+		uint64_t *word = bitmap->levels[l] + WORD_OF(bit);
+
+		*word &= ~MASK_OF(bit);
+
+		/* Still have set bits in this word. Keep the upper levels */
+		if (*word) break;
+		bit = WORD_OF(bit);
+	}
+}
+
+/**
+ * bitmap_find_first(@bitmap)
+ *
+ * RETURN
+ *   The index of the first set bit in @bitmap
+ *   @bitmap->nr_bits if no bit is set
+ */
+unsigned int bitmap_find_first(struct bitmap *bitmap)
+{
+	unsigned int index = 0;
+
+	if (!bitmap->levels[bitmap->nr_levels - 1][0]) return bitmap->nr_bits;
+
+	for (int l = bitmap->nr_levels - 1; l >= 0; l--) {
+		uint64_t word = bitmap->levels[l][index];
+
+		index = index * BITS_PER_WORD + __builtin_ctzll(word);
+	}
+	return index;
+}
+
+
+static inline void __frame_used(unsigned int pfn)
+{
+	struct free_frames *n = nodes + pfn_to_node(pfn);
+
+	bitmap_clear(&n->bitmap, pfn - n->first);
+	n->nr_free--;
+	nr_free--;
+}
+
+static inline void __frame_freed(unsigned int pfn)
+{
+	struct free_frames *n = nodes + pfn_to_node(pfn);
+
+	bitmap_set(&n->bitmap, pfn - n->first);
+	n->nr_free++;
+	nr_free++;
+}
+
+void init_frames(void)
+{
+	/* Drop the reverse maps of the page tables restored over, if any */
+	for (unsigned int i = 0; nodes && i < NR_NODES; i++) {
+		free_bitmap(&nodes[i].bitmap);
+	}
+	free(nodes);
+	free_bitmap(&prefetched_frames);
+	free(rmaps);
+	free(huge_mapcounts);
+	destroy_slab_cache(&rmap_cache);
+
+	nodes = calloc(NR_NODES, sizeof(*nodes));
+	for (unsigned int i = 0; i < NR_NODES; i++) {
+		struct free_frames *n = nodes + i;
+
+		n->first = i * FRAMES_PER_NODE;
+		n->nr_free = i == NR_NODES - 1 ?
+				NR_PAGEFRAMES - n->first : FRAMES_PER_NODE;
+		init_bitmap(&n->bitmap, n->nr_free, true);
+	}
+	nr_free = NR_PAGEFRAMES;
+	init_bitmap(&prefetched_frames, NR_PAGEFRAMES, false);
+	rmaps = calloc(NR_PAGEFRAMES, sizeof(*rmaps));
+	huge_mapcounts = calloc(NR_PAGEFRAMES, sizeof(*huge_mapcounts));
+	if (!page_contents) {
+		page_contents = calloc(NR_PAGEFRAMES, sizeof(*page_contents));
+	}
+
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		if (mapcounts[pfn]) __frame_used(pfn);
+		if (page_contents[pfn].prefetched) bitmap_set(&prefetched_frames, pfn);
+	}
+}
+
+/**
+ * The node to allocate from for the current process. Page frames are always
+ * allocated on behalf of the process running on the CPU
+ */
+static unsigned int __policy_node(void)
+{
+	unsigned int node;
+
+	if (NR_NODES == 1) return 0;
+
+	switch (numa_policy) {
+	case NUMA_INTERLEAVE:
+		node = current->next_node % NR_NODES;
+		current->next_node = (node + 1) % NR_NODES;
+		return node;
+	case NUMA_PREFERRED:
+		return current->home_node % NR_NODES;
+	default:
+		return cpu_to_node(this_cpu);
+	}
+}
+
+unsigned int get_free_frame(void)
+{
+	unsigned int node = __policy_node();
+
+	for (unsigned int i = 0; i < NR_NODES; i++) {
+		struct free_frames *n = nodes + (node + i) % NR_NODES;
+
+		if (!n->nr_free) continue;
+
+		if (i) count_event(node_fallbacks);
+		return n->first + bitmap_find_first(&n->bitmap);
+	}
+	return NR_PAGEFRAMES;
+}
+
+unsigned int get_free_frames(unsigned int nr_frames)
+{
+	/* O(NR_PAGEFRAMES), but huge pages are allocated rarely */
+	for (unsigned int pfn = 0; pfn + nr_frames <= NR_PAGEFRAMES;
+			pfn += nr_frames) {
+		unsigned int i;
+
+		for (i = 0; i < nr_frames && !mapcounts[pfn + i]; i++);
+		if (i == nr_frames) return pfn;
+	}
+	return NR_PAGEFRAMES;
+}
+
+static void __add_rmap(unsigned int pfn, struct pte *pte)
+{
+	struct rmap_item *item = slab_alloc(&rmap_cache);
+
+	item->pte = pte;
+	item->next = rmaps[pfn];
+	rmaps[pfn] = item;
+
+	if (pte_huge(pte)) huge_mapcounts[pfn]++;
+}
+
+void get_page(unsigned int pfn, struct pte *pte)
+{
+	bool was_evictable;
+
+	assert(pfn < NR_PAGEFRAMES);
+	was_evictable = __evictable(pfn);
+
+	__add_rmap(pfn, pte);
+	if (mapcounts[pfn]++ == 0) __frame_used(pfn);
+	__update_evictable(pfn, was_evictable);
+}
+
+void put_page(unsigned int pfn, struct pte *pte)
+{
+	struct rmap_item **link, *item;
+	bool was_evictable;
+
+	assert(pfn < NR_PAGEFRAMES && mapcounts[pfn]);
+	was_evictable = __evictable(pfn);
+
+	/* O(the number of PTEs mapping @pfn) */
+	for (link = &rmaps[pfn]; (*link)->pte != pte; link = &(*link)->next) {
+		assert((*link)->next);
+	}
+	item = *link;
+	*link = item->next;
+	slab_free(&rmap_cache, item);
+
+	if (pte_huge(pte)) huge_mapcounts[pfn]--;
+	if (--mapcounts[pfn] == 0) {
+		__frame_freed(pfn);
+		if (page_contents[pfn].prefetched) {
+			count_event(prefetch_wasted);
+			bitmap_clear(&prefetched_frames, pfn);
+		}
+		page_contents[pfn] = (struct page_content) { .tag = 0 };
+	}
+	__update_evictable(pfn, was_evictable);
+}
+
+void restore_rmap(unsigned int pfn, struct pte *pte)
+{
+	assert(pfn < NR_PAGEFRAMES && mapcounts[pfn]);
+
+	__add_rmap(pfn, pte);
+}
+
+void mark_frame_prefetched(unsigned int pfn)
+{
+	page_contents[pfn].prefetched = true;
+	bitmap_set(&prefetched_frames, pfn);
+}
+
+void clear_frame_prefetched(unsigned int pfn)
+{
+	page_contents[pfn].prefetched = false;
+	page_contents[pfn].populated = false;
+	bitmap_clear(&prefetched_frames, pfn);
+}
+
+unsigned int find_prefetched_frame(unsigned int keep)
+{
+	bool kept = keep < NR_PAGEFRAMES && page_contents[keep].prefetched;
+	unsigned int pfn;
+
+	if (kept) bitmap_clear(&prefetched_frames, keep);
+	pfn = bitmap_find_first(&prefetched_frames);
+	if (kept) bitmap_set(&prefetched_frames, keep);
+
+	return pfn;
+}
+
+unsigned int nr_free_frames(void)
+{
+	return nr_free;
+}
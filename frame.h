@@ -0,0 +1,194 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stdint.h>
+
+#include "types.h"
+
+/**
+ * Hierarchical bitmap. Bits in @levels[0] represent the items, and each bit
+ * in @levels[i] tells whether the corresponding word in @levels[i - 1] has
+ * any bit set. The topmost level always consists of a single word.
+ */
+#define BITMAP_MAX_LEVELS	8
+
+struct bitmap {
+	unsigned int nr_bits;
+	unsigned int nr_levels;
+	uint64_t *levels[BITMAP_MAX_LEVELS];
+};
+
+void init_bitmap(struct bitmap *bitmap, unsigned int nr_bits, bool set);
+void free_bitmap(struct bitmap *bitmap);
+void bitmap_set(struct bitmap *bitmap, unsigned int bit);
+void bitmap_clear(struct bitmap *bitmap, unsigned int bit);
+unsigned int bitmap_find_first(struct bitmap *bitmap);
+
+
+/**
+ * Page frame allocator. Keeps track of free page frames of each memory node
+ * alongside @mapcounts[] so that the smallest free page frame of a node is
+ * found in constant time. init_frames() takes the page frames counted in
+ * @mapcounts[] as in use, and drops the reverse maps built so far. The
+ * contents of the page frames below are kept, and the page frames prefetched
+ * are found from them.
+ */
+void init_frames(void);
+
+/**
+ * Memory node to allocate the page frames of the current process from
+ */
+enum numa_policy {
+	NUMA_LOCAL = 0,		/* The node of the running CPU */
+	NUMA_INTERLEAVE,	/* The nodes in turn, from the home node */
+	NUMA_PREFERRED,		/* The home node of the process */
+};
+
+extern enum numa_policy numa_policy;
+
+/**
+ * get_free_frame()
+ *
+ * DESCRIPTION
+ *   Find a free page frame on the node chosen by @numa_policy. The nodes
+ *   after it are tried in turn if the node has no free page frame, which is
+ *   counted in @node_fallbacks. With a single node, it is the smallest page
+ *   frame number in the system.
+ *
+ * RETURN
+ *   The smallest page frame number on the node that is not mapped by any PTE.
+ *   NR_PAGEFRAMES if all page frames are in use.
+ */
+unsigned int get_free_frame(void);
+
+/**
+ * get_free_frames(@nr_frames)
+ *
+ * RETURN
+ *   The smallest page frame number aligned to @nr_frames that starts
+ *   @nr_frames free page frames in a row.
+ *   NR_PAGEFRAMES if there is no such run of page frames.
+ */
+unsigned int get_free_frames(unsigned int nr_frames);
+
+/**
+ * Reverse map. Each page frame keeps the list of the PTEs mapping it, so the
+ * mappings of a page frame are found without walking the page tables. The
+ * list is as long as @mapcounts[pfn]. A PTE in the directories shared by fork
+ * appears once for all the sharers.
+ */
+struct pte;
+
+struct rmap_item {
+	struct pte *pte;
+	struct rmap_item *next;
+};
+
+extern struct rmap_item **rmaps;
+
+#define for_each_rmap(item, pfn)	\
+	for (item = rmaps[pfn]; item; item = item->next)
+
+/**
+ * get_page(@pfn, @pte)/put_page(@pfn, @pte)
+ *
+ * DESCRIPTION
+ *   Add/remove @pte to/from the reverse map of page frame @pfn, and
+ *   increase/decrease the mapcount of the page frame. The page frame becomes
+ *   free when its mapcount drops to 0. The page frames mapped by huge PTEs
+ *   are not swapped out.
+ */
+void get_page(unsigned int pfn, struct pte *pte);
+void put_page(unsigned int pfn, struct pte *pte);
+
+/**
+ * restore_rmap(@pfn, @pte)
+ *
+ * DESCRIPTION
+ *   Add @pte to the reverse map of page frame @pfn, which @mapcounts[]
+ *   already counts. Used to rebuild the reverse maps of the page tables
+ *   restored from a checkpoint.
+ */
+void restore_rmap(unsigned int pfn, struct pte *pte);
+
+/**
+ * Contents of the page frames. The data of the pages are not simulated, but
+ * each page frame has a tag standing for its data, so that the page frames
+ * with the same tag are taken to hold the same data. A page frame is filled
+ * with zeros (tag 0) when it becomes free, and a write to a page mixes the
+ * VPN written into the tag of its page frame. So the copies of a page keep
+ * the same data as long as they are written in the same way. @merged is set
+ * for the page frames that merge_pages() has merged the others into.
+ * @prefetched is set for the page frames brought in by the prefetcher until
+ * they are accessed. @populated is also set if the page frame is populated
+ * for a page allocated on demand, which holds no data until accessed. The
+ * PTEs mapping such a page frame are for @vpn in the page tables.
+ */
+struct page_content {
+	uint64_t tag;
+	bool merged;
+	bool prefetched;
+	bool populated;
+	unsigned int vpn;
+};
+
+extern struct page_content *page_contents;
+
+/**
+ * mark_frame_prefetched(@pfn)/clear_frame_prefetched(@pfn)
+ *
+ * DESCRIPTION
+ *   Set @prefetched of page frame @pfn, or clear both @prefetched and
+ *   @populated of the page frame.
+ */
+void mark_frame_prefetched(unsigned int pfn);
+void clear_frame_prefetched(unsigned int pfn);
+
+/**
+ * find_prefetched_frame(@keep)
+ *
+ * RETURN
+ *   The smallest page frame number with @prefetched set other than @keep.
+ *   NR_PAGEFRAMES if there is no such page frame.
+ */
+unsigned int find_prefetched_frame(unsigned int keep);
+
+static inline void write_page_content(unsigned int pfn, unsigned int vpn)
+{
+	/* The finalizer of splitmix64 */
+	uint64_t x = page_contents[pfn].tag + vpn + 0x9e3779b97f4a7c15ULL;
+
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	page_contents[pfn].tag = x ^ (x >> 31);
+}
+
+static inline void copy_page_content(unsigned int dst, unsigned int src)
+{
+	page_contents[dst].tag = page_contents[src].tag;
+}
+
+/**
+ * nr_free_frames()
+ *
+ * RETURN
+ *   The number of page frames that are not mapped by any PTE
+ */
+unsigned int nr_free_frames(void);
+
+#endif
@@ -0,0 +1,143 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdlib.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "stats.h"
+#include "ksm.h"
+
+extern unsigned int *mapcounts;
+
+extern void flush_tlb_pfns(unsigned int *pfns, unsigned int nr);
+
+static unsigned int merge_period = 0;
+static unsigned int nr_refs_to_merge = 0;
+
+struct merge_candidate {
+	uint64_t tag;
+	unsigned int pfn;
+};
+
+static int __compare_candidates(const void *a, const void *b)
+{
+	const struct merge_candidate *ca = a;
+	const struct merge_candidate *cb = b;
+
+	if (ca->tag != cb->tag) return (ca->tag > cb->tag) - (ca->tag < cb->tag);
+	return (ca->pfn > cb->pfn) - (ca->pfn < cb->pfn);
+}
+
+static bool __mergeable(unsigned int pfn)
+{
+	struct rmap_item *item;
+
+	if (!mapcounts[pfn]) return false;
+
+	/* Left at their VPN to be dropped if evicted untouched. See frame.h */
+	if (page_contents[pfn].populated) return false;
+
+	for_each_rmap(item, pfn) {
+		if (pte_huge(item->pte)) return false;
+	}
+	return true;
+}
+
+/* Writes to @pte fault and copy the page frame from now on */
+static unsigned int __cow_flags(struct pte *pte)
+{
+	return pte_flags(pte) & ~PTE_WRITABLE;
+}
+
+/* Move the mappings of @dup to @keep */
+static void __merge_frame(unsigned int keep, unsigned int dup)
+{
+	while (rmaps[dup]) {
+		struct pte *pte = rmaps[dup]->pte;
+
+		set_pte(pte, keep, __cow_flags(pte));
+		get_page(keep, pte);
+		put_page(dup, pte);
+	}
+}
+
+unsigned int merge_pages(void)
+{
+	struct merge_candidate *candidates;
+	unsigned int *pfns;
+	unsigned int nr = 0, nr_pfns = 0, nr_merged = 0;
+
+	count_event(merge_passes);
+
+	candidates = malloc(sizeof(*candidates) * NR_PAGEFRAMES);
+	for (unsigned int pfn = 0; pfn < NR_PAGEFRAMES; pfn++) {
+		if (!__mergeable(pfn)) continue;
+
+		candidates[nr++] = (struct merge_candidate) {
+			.tag = page_contents[pfn].tag,
+			.pfn = pfn,
+		};
+	}
+	qsort(candidates, nr, sizeof(*candidates), __compare_candidates);
+
+	/* The page frames of the same content are in a row from the smallest */
+	pfns = malloc(sizeof(*pfns) * (nr ? nr : 1));
+	for (unsigned int i = 0, j; i < nr; i = j) {
+		unsigned int keep = candidates[i].pfn;
+		struct rmap_item *item;
+
+		for (j = i + 1; j < nr && candidates[j].tag == candidates[i].tag; j++);
+		if (j == i + 1) continue;
+
+		for_each_rmap(item, keep) {
+			set_pte(item->pte, keep, __cow_flags(item->pte));
+		}
+		page_contents[keep].merged = true;
+		pfns[nr_pfns++] = keep;
+
+		for (unsigned int k = i + 1; k < j; k++) {
+			__merge_frame(keep, candidates[k].pfn);
+			pfns[nr_pfns++] = candidates[k].pfn;
+			nr_merged++;
+		}
+	}
+
+	/* Cached translations would write to the merged page frames */
+	flush_tlb_pfns(pfns, nr_pfns);
+
+	free(pfns);
+	free(candidates);
+
+	vm_stats.pages_merged += nr_merged;
+	return nr_merged;
+}
+
+void init_merger(unsigned int period)
+{
+	merge_period = period;
+	nr_refs_to_merge = period;
+}
+
+void merger_tick(void)
+{
+	if (--nr_refs_to_merge) return;
+
+	nr_refs_to_merge = merge_period;
+	merge_pages();
+}
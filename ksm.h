@@ -0,0 +1,54 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __KSM_H__
+#define __KSM_H__
+
+#include "types.h"
+
+/**
+ * Same-page merging like KSM. A merge pass finds the page frames in use
+ * with the same content (see struct page_content) across the processes,
+ * and remaps the PTEs of each group to the smallest page frame of the
+ * group, which is kept and shared copy-on-write as fork does. The other
+ * page frames of the group become free. Writable PTEs of the merged pages
+ * become copy-on-write, and the TLB entries of the page frames involved are
+ * shot down at once for the pass. Page frames mapped by huge pages are not
+ * merged.
+ *
+ * The pass runs on the merge command, and in the background every @period
+ * references if init_merger() is called.
+ */
+
+/**
+ * merge_pages()
+ *
+ * RETURN
+ *   The number of page frames freed by merging
+ */
+unsigned int merge_pages(void);
+
+/**
+ * init_merger(@period)/merger_tick()
+ *
+ * DESCRIPTION
+ *   Run a merge pass once in @period calls to merger_tick(), which is called
+ *   for each reference.
+ */
+void init_merger(unsigned int period);
+void merger_tick(void);
+
+#endif
@@ -21,6 +21,13 @@
 #include "types.h"
 #include "list_head.h"
 #include "vm.h"
+#include "frame.h"
+#include "pagetable.h"
+#include "slab.h"
+#include "stats.h"
+#include "swap.h"
+#include "tlb.h"
+#include "vma.h"
 
 /**
  * Ready queue of the system
@@ -40,16 +47,101 @@ extern struct pagetable *ptbr;
 /**
  * TLB of the system.
  */
-//256개?
-extern struct tlb_entry tlb[1UL << (PTES_PER_PAGE_SHIFT * 2)];
-int tlbSize = 0;
+extern struct tlb_entry *tlb;
+
+/**
+ * TLB for huge pages. Its entries are tagged with the huge page number
+ */
+extern struct tlb_entry *huge_tlb;
+
+/**
+ * Second-level TLB behind @tlb. NULL if there is no STLB
+ */
+extern struct tlb_entry *stlb;
+
+/**
+ * Paging-structure cache of the MMU. Its entries should be invalidated
+ * along with the TLB entries
+ */
+extern void invalidate_psc(unsigned int asid, unsigned int vpn);
+extern void flush_psc_asid(unsigned int asid);
+
+/**
+ * @current, @ptbr, and the TLBs above are of @this_cpu running the trace.
+ * Other CPUs drop their cached translations on smp_call_function(), which
+ * runs @func on each CPU in @mask except @this_cpu.
+ */
+extern void smp_call_function(uint64_t mask, void (*func)(void *), void *info);
+
+/**
+ * Insertion counter to stamp TLB entries. The entry with the smallest stamp
+ * in a set is the first one to be replaced in FIFO. The replacement policy
+ * in tlb.h picks the victim when the ways of a set are all valid.
+ */
+extern unsigned long tlb_clock;
 
 /**
  * The number of mappings for each page frame. Can be used to determine how
  * many processes are using the page frames.
  */
-extern unsigned int mapcounts[];
+extern unsigned int *mapcounts;
 
+/**
+ * Address space ID of the current process. TLB entries are tagged with it
+ * so that the TLB needs not be flushed on context switches.
+ */
+static inline unsigned int current_asid(void)
+{
+    return current->asid;
+}
+
+/**
+ * Ways of the TLB set that may cache @vpn
+ */
+static inline struct tlb_entry *tlb_set(unsigned int vpn)
+{
+    return tlb + TLB_SET_OF(vpn) * NR_TLB_WAYS;
+}
+
+static inline struct tlb_entry *stlb_set(unsigned int vpn)
+{
+    return stlb + STLB_SET_OF(vpn) * NR_STLB_WAYS;
+}
+
+/**
+ * Fill the mapping from @vpn to @pfn into one of @nr_ways ways from @set.
+ * The entry already caching @vpn is updated in place. Otherwise, an empty
+ * way is taken first, and the victim of the replacement policy is replaced
+ * when there is no empty one.
+ */
+static struct tlb_entry *fill_tlb(struct tlb_entry *set, unsigned int nr_ways,
+        unsigned int vpn, unsigned int pfn, bool dirty)
+{
+    struct tlb_entry *victim = NULL;
+    unsigned int asid = current_asid();
+
+    for (int i = 0; i < nr_ways; i++) {
+        if (set[i].valid && set[i].asid == asid && set[i].vpn == vpn) {
+            set[i].pfn = pfn;
+            set[i].dirty = dirty;
+            tlb_hit(set, nr_ways, &set[i]);
+            return &set[i];
+        }
+        if (!victim && !set[i].valid) victim = &set[i];
+    }
+    if (!victim) victim = tlb_select_victim(set, nr_ways);
+
+    victim->valid = true;
+    victim->dirty = dirty;
+    victim->referenced = false;
+    victim->asid = asid;
+    victim->vpn = vpn;
+    victim->pfn = pfn;
+    victim->stamp = ++tlb_clock;
+    victim->rank = 0;
+    tlb_fill(set, nr_ways, victim);
+    return victim;
+}
 
 /**
  * lookup_tlb(@vpn, @pfn)
@@ -57,57 +149,303 @@ extern unsigned int mapcounts[];
  * DESCRIPTION
  *   Translate @vpn of the current process through TLB. DO NOT make your own
  *   data structure for TLB, but use the defined @tlb data structure
- *   to translate. If the requested VPN exists in the TLB, return true
- *   with @pfn is set to its PFN. Otherwise, return false.
+ *   to translate. If the requested VPN exists in the TLB, return its entry
+ *   with @pfn is set to its PFN. Otherwise, return NULL.
  *   The framework calls this function when needed, so do not call
  *   this function manually.
  *
  * RETURN
- *   Return true if the translation is cached in the TLB.
- *   Return false otherwise
+ *   Return the TLB entry if the translation is cached in the TLB.
+ *   Return NULL otherwise
  */
-bool lookup_tlb(unsigned int vpn, unsigned int *pfn)
+struct tlb_entry *lookup_tlb(unsigned int vpn, unsigned int *pfn)
 {
-	for(int i = 0; i < tlbSize; i++) {
-        if(tlb[i].vpn == vpn) {
-            *pfn = tlb[i].pfn;
-            return true;
+    struct tlb_entry *set = tlb_set(vpn);
+    unsigned int asid = current_asid();
+
+    for (int i = 0; i < NR_TLB_WAYS; i++) {
+        if (set[i].valid && set[i].asid == asid && set[i].vpn == vpn) {
+            *pfn = set[i].pfn;
+            tlb_hit(set, NR_TLB_WAYS, &set[i]);
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * lookup_huge_tlb(@vpn, @pfn)
+ *
+ * DESCRIPTION
+ *   Same as lookup_tlb(), but translate @vpn through the huge page TLB.
+ */
+struct tlb_entry *lookup_huge_tlb(unsigned int vpn, unsigned int *pfn)
+{
+    unsigned int hpn = vpn >> HUGE_PAGE_SHIFT;
+    unsigned int asid = current_asid();
+
+    for (int i = 0; i < NR_HUGE_TLB_ENTRIES; i++) {
+        struct tlb_entry *t = huge_tlb + i;
+
+        if (t->valid && t->asid == asid && t->vpn == hpn) {
+            *pfn = t->pfn + (vpn & (NR_HUGE_PAGE_PAGES - 1));
+            tlb_hit(huge_tlb, NR_HUGE_TLB_ENTRIES, t);
+            return t;
         }
     }
-	return false;
+    return NULL;
 }
 
-int find_smallest_pfn(unsigned int* mapcounts)
+/**
+ * lookup_stlb(@vpn, @pfn)
+ *
+ * DESCRIPTION
+ *   Same as lookup_tlb(), but translate @vpn through the second-level TLB
+ *   when the TLBs above miss. The translation found is filled into the TLB,
+ *   and the entry of the TLB is returned.
+ */
+struct tlb_entry *lookup_stlb(unsigned int vpn, unsigned int *pfn)
 {
-    bool found = false;
-    for(int i = 0; i < NR_PAGEFRAMES; i++) {
-        if(*(mapcounts++) == 0) {
-            found = true;
-            return i;
+    struct tlb_entry *set;
+    unsigned int asid = current_asid();
+
+    if (NR_STLB_ENTRIES == 0) return NULL;
+
+    set = stlb_set(vpn);
+    for (int i = 0; i < NR_STLB_WAYS; i++) {
+        if (set[i].valid && set[i].asid == asid && set[i].vpn == vpn) {
+            *pfn = set[i].pfn;
+            tlb_hit(set, NR_STLB_WAYS, &set[i]);
+            return fill_tlb(tlb_set(vpn), NR_TLB_WAYS, vpn, set[i].pfn, set[i].dirty);
         }
     }
-    
-    if (found == false) {
-        fprintf(stderr, "[ERROR] MAX find_smallest_pfn");
+    return NULL;
+}
+
+/**
+ * invalidate_tlb(@asid, @vpn)
+ *
+ * DESCRIPTION
+ *   Drop the cached translation for @vpn of address space @asid from the TLB
+ *   if exists. The huge page covering @vpn is dropped from the huge page TLB
+ *   as well, and so is the cached page directory for @vpn. The other CPUs
+ *   that have run the current process are asked to drop theirs too.
+ */
+static void local_invalidate_tlb(unsigned int asid, unsigned int vpn)
+{
+    struct tlb_entry *set = tlb_set(vpn);
+
+    invalidate_psc(asid, vpn);
+
+    for (int i = 0; i < NR_HUGE_TLB_ENTRIES; i++) {
+        struct tlb_entry *t = huge_tlb + i;
+
+        if (t->valid && t->asid == asid && t->vpn == (vpn >> HUGE_PAGE_SHIFT)) {
+            t->valid = false;
+        }
+    }
+
+    for (int i = 0; i < NR_TLB_WAYS; i++) {
+        if (set[i].valid && set[i].asid == asid && set[i].vpn == vpn) {
+            set[i].valid = false;
+            break;
+        }
+    }
+
+    if (NR_STLB_ENTRIES == 0) return;
+    set = stlb_set(vpn);
+    for (int i = 0; i < NR_STLB_WAYS; i++) {
+        if (set[i].valid && set[i].asid == asid && set[i].vpn == vpn) {
+            set[i].valid = false;
+            return;
+        }
     }
-    return NR_PAGEFRAMES;
+}
+
+// arguments of the shootdown handlers running on the other CPUs
+struct flush_info {
+    unsigned int asid;
+    unsigned int vpn;
+};
+
+static void do_invalidate_tlb(void *info)
+{
+    struct flush_info *f = info;
+
+    local_invalidate_tlb(f->asid, f->vpn);
+}
+
+static void invalidate_tlb(unsigned int asid, unsigned int vpn)
+{
+    struct flush_info info = { .asid = asid, .vpn = vpn };
+
+    local_invalidate_tlb(asid, vpn);
+    smp_call_function(current->cpumask, do_invalidate_tlb, &info);
 }
 
 /**
- * insert_tlb(@vpn, @pfn)
+ * flush_tlb_asid(@asid)
  *
  * DESCRIPTION
- *   Insert the mapping from @vpn to @pfn into the TLB. The framework will call
- *   this function when required, so no need to call this function manually.
+ *   Drop all cached translations of address space @asid of the current
+ *   process on all CPUs that have run it. Only this CPU may cache them
+ *   afterward.
+ */
+static void local_flush_tlb_asid(unsigned int asid)
+{
+    flush_psc_asid(asid);
+    for (int i = 0; i < NR_TLB_ENTRIES; i++) {
+        if (tlb[i].valid && tlb[i].asid == asid) {
+            tlb[i].valid = false;
+        }
+    }
+    for (int i = 0; i < NR_HUGE_TLB_ENTRIES; i++) {
+        if (huge_tlb[i].valid && huge_tlb[i].asid == asid) {
+            huge_tlb[i].valid = false;
+        }
+    }
+    for (int i = 0; i < NR_STLB_ENTRIES; i++) {
+        if (stlb[i].valid && stlb[i].asid == asid) {
+            stlb[i].valid = false;
+        }
+    }
+}
+
+static void do_flush_tlb_asid(void *info)
+{
+    local_flush_tlb_asid(*(unsigned int *)info);
+}
+
+static void flush_tlb_asid(unsigned int asid)
+{
+    local_flush_tlb_asid(asid);
+    smp_call_function(current->cpumask, do_flush_tlb_asid, &asid);
+    current->cpumask = cpu_bit(this_cpu);
+}
+
+// drop the cached translations of @p, which may not be the current one
+static void flush_tlb_process(struct process *p)
+{
+    if (p->cpumask & cpu_bit(this_cpu)) local_flush_tlb_asid(p->asid);
+    smp_call_function(p->cpumask, do_flush_tlb_asid, &p->asid);
+}
+
+// drop the cached translation and page directory for @vpn of @p, which may
+// not be the current one
+void invalidate_tlb_process(struct process *p, unsigned int vpn)
+{
+    struct flush_info info = { .asid = p->asid, .vpn = vpn };
+
+    if (p->cpumask & cpu_bit(this_cpu)) local_invalidate_tlb(p->asid, vpn);
+    smp_call_function(p->cpumask, do_invalidate_tlb, &info);
+}
+
+/**
+ * flush_tlb_pfn(@pfn)
  *
+ * DESCRIPTION
+ *   Drop all cached translations to page frame @pfn from any address space.
+ *   Any process may map the page frame, so all CPUs drop theirs.
  */
-void insert_tlb(unsigned int vpn, unsigned int pfn)
+static void local_flush_tlb_pfn(unsigned int pfn)
+{
+    for (int i = 0; i < NR_TLB_ENTRIES; i++) {
+        if (tlb[i].valid && tlb[i].pfn == pfn) {
+            tlb[i].valid = false;
+        }
+    }
+    for (int i = 0; i < NR_HUGE_TLB_ENTRIES; i++) {
+        struct tlb_entry *t = huge_tlb + i;
+
+        if (t->valid && pfn - t->pfn < NR_HUGE_PAGE_PAGES) {
+            t->valid = false;
+        }
+    }
+    for (int i = 0; i < NR_STLB_ENTRIES; i++) {
+        if (stlb[i].valid && stlb[i].pfn == pfn) {
+            stlb[i].valid = false;
+        }
+    }
+}
+
+static void do_flush_tlb_pfn(void *info)
 {
-	struct tlb_entry new_entry;
-    new_entry.valid = true;
-    new_entry.vpn = vpn;
-    new_entry.pfn = pfn;
-    tlb[tlbSize++] = new_entry;
+    local_flush_tlb_pfn(*(unsigned int *)info);
+}
+
+void flush_tlb_pfn(unsigned int pfn)
+{
+    local_flush_tlb_pfn(pfn);
+    smp_call_function(~0ULL, do_flush_tlb_pfn, &pfn);
+}
+
+// flush a batch of page frames with a single round of IPIs
+struct flush_pfns_info {
+    unsigned int *pfns;
+    unsigned int nr;
+};
+
+static void do_flush_tlb_pfns(void *info)
+{
+    struct flush_pfns_info *f = info;
+
+    for (unsigned int i = 0; i < f->nr; i++) {
+        local_flush_tlb_pfn(f->pfns[i]);
+    }
+}
+
+void flush_tlb_pfns(unsigned int *pfns, unsigned int nr)
+{
+    struct flush_pfns_info info = { .pfns = pfns, .nr = nr };
+
+    if (!nr) return;
+
+    do_flush_tlb_pfns(&info);
+    smp_call_function(~0ULL, do_flush_tlb_pfns, &info);
+}
+
+// free frames are tracked by the bitmap in frame.c along with mapcounts.
+// when they run out, swap out a page other than @keep if swapping is enabled.
+// the callers report the failure, i.e., memory is full or the access fails
+int find_smallest_pfn(unsigned int keep)
+{
+    unsigned int pfn = get_free_frame();
+
+    if (pfn == NR_PAGEFRAMES && reclaim_frame(keep)) {
+        pfn = get_free_frame();
+    }
+    return pfn;
+}
+
+/**
+ * insert_tlb(@vpn, @pfn, @dirty)
+ *
+ * DESCRIPTION
+ *   Insert the mapping from @vpn to @pfn into the TLB, and into the
+ *   second-level TLB if exists. @dirty tells whether the PTE is dirty
+ *   already. The framework will call this function when
+ *   required, so no need to call this function manually.
+ *
+ */
+void insert_tlb(unsigned int vpn, unsigned int pfn, bool dirty)
+{
+    fill_tlb(tlb_set(vpn), NR_TLB_WAYS, vpn, pfn, dirty);
+    if (NR_STLB_ENTRIES) fill_tlb(stlb_set(vpn), NR_STLB_WAYS, vpn, pfn, dirty);
+}
+
+/**
+ * insert_huge_tlb(@vpn, @pfn, @dirty)
+ *
+ * DESCRIPTION
+ *   Insert the huge page translating @vpn to @pfn into the huge page TLB.
+ */
+void insert_huge_tlb(unsigned int vpn, unsigned int pfn, bool dirty)
+{
+    if (NR_HUGE_TLB_ENTRIES == 0) return;
+
+    // the huge TLB is a single set of all the entries
+    fill_tlb(huge_tlb, NR_HUGE_TLB_ENTRIES, vpn >> HUGE_PAGE_SHIFT,
+            pfn - (vpn & (NR_HUGE_PAGE_PAGES - 1)), dirty);
 }
 
 
@@ -129,71 +467,136 @@ void insert_tlb(unsigned int vpn, unsigned int pfn)
  */
 unsigned int alloc_page(unsigned int vpn, unsigned int rw)
 {
-    unsigned int outer;
-    unsigned int inner;
-    outer = vpn / NR_PTES_PER_PAGE;
-    inner = vpn % NR_PTES_PER_PAGE;
-
-    // if memory is not allocated, allocate memory
-    if(!ptbr->outer_ptes[outer]) {
-    ptbr->outer_ptes[outer] = malloc(sizeof(struct pte_directory)*NR_PTES_PER_PAGE);
-    }
-    struct pte* pte = &(ptbr->outer_ptes[outer]->ptes[inner]);
-    // set valid true
-    pte->valid = true;
-    if(rw == RW_READ) {
-        pte->writable = false;
-        pte->private = RW_READ;
-    } else if(rw == (RW_WRITE | RW_READ)) {
-        pte->writable = true;
-    }
     //set pfn to possible smallest pfn
-    int smallest_pfn = find_smallest_pfn(mapcounts);
+    int smallest_pfn = find_smallest_pfn(NR_PAGEFRAMES);
 
     // return -1 if all page frames are allocated
     if(smallest_pfn == NR_PAGEFRAMES) {
         return -1;
     }
 
-    pte->pfn = smallest_pfn;
-    mapcounts[smallest_pfn]++;
+    // directories on the way are allocated if not exist
+    struct pte* pte = populate_pte(ptbr, vpn);
+    // set valid true
+    unsigned int flags = PTE_VALID;
+    if(rw == (RW_WRITE | RW_READ)) {
+        flags |= PTE_WRITABLE;
+    }
+
+    set_pte(pte, smallest_pfn, flags);
+    get_page(smallest_pfn, pte);
+    map_vmas(&current->vmas, vpn, vpn + 1, vma_prot(rw));
+    count_event(allocs);
 
     //inc s_smallest_pfn by 1
     return smallest_pfn;
 }
 
 
+/**
+ * alloc_huge_page(@vpn, @rw)
+ *
+ * DESCRIPTION
+ *   Map the huge page covering @vpn to NR_HUGE_PAGE_PAGES free page frames
+ *   in a row. The huge page should not have any page in use.
+ *
+ * RETURN
+ *   Return the first page frame number of the huge page.
+ *   Return -1 if there are not enough free page frames in a row.
+ */
+unsigned int alloc_huge_page(unsigned int vpn, unsigned int rw)
+{
+    unsigned int pfn = get_free_frames(NR_HUGE_PAGE_PAGES);
+
+    if(pfn == NR_PAGEFRAMES) {
+        return -1;
+    }
+
+    struct pte* pte = populate_huge_pte(ptbr, vpn);
+    unsigned int flags = PTE_VALID | PTE_HUGE;
+    if(rw == (RW_WRITE | RW_READ)) {
+        flags |= PTE_WRITABLE;
+    }
+
+    set_pte(pte, pfn, flags);
+    for (unsigned int i = 0; i < NR_HUGE_PAGE_PAGES; i++) {
+        get_page(pfn + i, pte);
+    }
+    map_vmas(&current->vmas, vpn, vpn + NR_HUGE_PAGE_PAGES, vma_prot(rw));
+    count_event(huge_allocs);
+
+    return pfn;
+}
+
+
+/**
+ * reserve_pages(@vpn, @nr_pages, @rw)
+ *
+ * DESCRIPTION
+ *   Allocate @nr_pages pages from @vpn for @rw without page frames. Only the
+ *   area of the pages is set up, and the page frames are allocated by
+ *   handle_page_fault() when the pages are accessed for the first time.
+ */
+void reserve_pages(unsigned int vpn, unsigned int nr_pages, unsigned int rw)
+{
+    map_vmas(&current->vmas, vpn, vpn + nr_pages, vma_prot(rw));
+    vm_stats.reserves += nr_pages;
+}
+
+
 /**
  * free_page(@vpn)
  *
  * DESCRIPTION
  *   Deallocate the page from the current processor. Make sure that the fields
- *   for the corresponding PTE (valid, writable, pfn) is set @false or 0.
+ *   for the corresponding PTE (valid, writable, pfn) is cleared.
  *   Also, consider carefully for the case when a page is shared by two processes,
  *   and one process is to free the page.
  */
 void free_page(unsigned int vpn)
 {
-    unsigned int outer;
-    unsigned int inner;
-    outer = vpn / NR_PTES_PER_PAGE;
-    inner = vpn % NR_PTES_PER_PAGE;
+    bool populated = !vma_unpopulated(&current->vmas, ptbr, vpn);
+    struct pte *pte;
 
-    struct pte* pte = &(ptbr->outer_ptes[outer]->ptes[inner]);
+    // the page may not be populated yet. then only its area goes away
+    unmap_vmas(&current->vmas, vpn, vpn + 1);
+    if (!populated) {
+        count_event(frees);
+        return;
+    }
 
-    pte->valid = false;
-    pte->writable = false;
-    mapcounts[pte->pfn]--;
-    pte->pfn = 0;
+    // free a part of the huge page. the rest remains mapped by regular ptes
+    if (lookup_huge_pte(ptbr, vpn)) {
+        split_huge_pte(ptbr, vpn);
+        invalidate_tlb(current_asid(), vpn);
+    }
 
-    //struct tlb_entry default_tlb;
-    for(int i = 0; i < tlbSize; i++) {
-        if(tlb[i].vpn == vpn) {
-            tlb[i].valid = false;
-            tlbSize--;
-            return;
-        }
+    // the page directory might be shared with others after fork
+    pte = unshare_pte(ptbr, vpn);
+
+    // the page might be swapped out
+    if (pte_swapped(pte)) {
+        swap_free(pte_swap_slot(pte));
+    } else {
+        put_page(pte_pfn(pte), pte);
     }
+    clear_pte(pte);
+
+    // reclaim the directories that become empty
+    depopulate_pte(ptbr, vpn);
+
+    invalidate_tlb(current_asid(), vpn);
+    count_event(frees);
+}
+
+
+// page frames of the huge page @pte are not mapped by others
+static bool huge_page_exclusive(struct pte *pte)
+{
+    for (unsigned int i = 0; i < NR_HUGE_PAGE_PAGES; i++) {
+        if (mapcounts[pte_pfn(pte) + i] != 1) return false;
+    }
+    return true;
 }
 
 
@@ -215,59 +618,218 @@ void free_page(unsigned int vpn)
  */
 bool handle_page_fault(unsigned int vpn, unsigned int rw)
 {
-    unsigned int outer;
-    unsigned int inner;
-    outer = vpn / NR_PTES_PER_PAGE;
-    inner = vpn % NR_PTES_PER_PAGE;
+    bool shared;
+    // the area of the page tells if the page may be written. the PTE does
+    // not when it is write-protected for copy-on-write
+    struct vma *vma = find_vma(&current->vmas, vpn);
+    bool writable = vma && vma_writable(vma);
+    struct pte *pte = lookup_huge_pte(ptbr, vpn);
+
+    // write to the huge page. if nobody else maps the page frames after
+    // fork, just make it writable. otherwise split the huge page so that
+    // only the page to write is copied below
+    if (pte) {
+        if (!writable || (rw & RW_WRITE) == 0) {
+            count_event(faults_write_protect);
+            return false;
+        }
+        if (huge_page_exclusive(pte)) {
+            set_pte(pte, pte_pfn(pte), pte_flags(pte) | PTE_WRITABLE);
+            count_event(faults_write_protect);
+            count_event(cow_reuses);
+            return true;
+        }
+        split_huge_pte(ptbr, vpn);
+        invalidate_tlb(current_asid(), vpn);
+    }
 
-    struct pte *pte;
+    pte = lookup_pte(ptbr, vpn, &shared);
 
-    // 안들어오는데?
-    // pte is invalid
-    if(ptbr->outer_ptes[outer] != NULL ) {
-        pte = &(ptbr->outer_ptes[outer]->ptes[inner]);
-        if (pte->valid == false) {
+    // first access to the page allocated on demand, which is in the area
+    // without the PTE. the page frame is mapped through a private copy of
+    // the directory, since the processes sharing the directory after fork
+    // may not have the page
+    if (vma && (pte == NULL || pte_none(pte))) {
+        unsigned int pfn;
+
+        if((rw & RW_WRITE) == RW_WRITE && !writable) {
             return false;
         }
+
+        pfn = find_smallest_pfn(NR_PAGEFRAMES);
+        if(pfn == NR_PAGEFRAMES) {
+            return false;
+        }
+        pte = populate_pte(ptbr, vpn);
+        set_pte(pte, pfn, PTE_VALID | (writable ? PTE_WRITABLE : 0));
+        get_page(pfn, pte);
+        count_event(demand_faults);
+        return true;
     }
-    
+
     // 안들어오는데?
     // page directory is invalid
-    if(ptbr->outer_ptes[outer] == NULL) {
-        fprintf(stderr,"pte invalid2");
+    if(pte == NULL) {
+        count_event(faults_no_directory);
+        return false;
+    }
+
+    // the page is swapped out. bring it in first, and the write access is
+    // handled below as if the page were not swapped out
+    if (pte_swapped(pte)) {
+        if (!swap_in(pte)) return false;
+        if ((rw & RW_WRITE) == 0) return true;
+        if (pte_writable(pte) && !shared) return true;
+    }
+
+    // 안들어오는데?
+    // pte is invalid
+    if (pte_valid(pte) == false) {
+        count_event(faults_invalid_pte);
+        return false;
+    }
+
+    count_event(faults_write_protect);
+
+    //원래 read만 가능
+    if(!pte_writable(pte) && !writable && (rw & RW_WRITE) == RW_WRITE) {
         return false;
     }
+
+    // page directory is shared with others after fork. Get a private copy
+    // of the directory, and the pte gets copy-on-write
+    if(shared && (rw & RW_WRITE) == RW_WRITE) {
+        pte = unshare_pte(ptbr, vpn);
+    }
+
     //pte is not writable but @rw is for write
-    pte = &(ptbr->outer_ptes[outer]->ptes[inner]);
-    if(pte->writable == false && (rw & RW_WRITE) == RW_WRITE) {
-        //원래 read만 가능
-        if(pte->private == RW_READ) {
-            return false;
-        }
+    if(pte_writable(pte) == false && (rw & RW_WRITE) == RW_WRITE) {
         //원래 write 가능이지만 fork하느라 바뀜
-        if(pte->private != RW_READ) {
+        if(writable) {
+            unsigned int pfn = pte_pfn(pte);
+            unsigned int flags = pte_flags(pte) | PTE_WRITABLE;
             // 나만 참조하고있음
-            if(mapcounts[pte->pfn] == 1) {
-                pte->writable = true;
+            if(mapcounts[pfn] == 1) {
+                count_event(cow_reuses);
+                // the swap slot should keep the contents before the write
+                swap_detach_frame(pfn);
+                set_pte(pte, pfn, flags);
                 return true;
             }
             // 다른애도 참조하고 있음
-            if(mapcounts[pte->pfn] >= 2) {
-                mapcounts[pte->pfn]--;
-                pte->pfn = find_smallest_pfn(mapcounts);
-                pte->writable = true;
-                mapcounts[pte->pfn]++;
+            if(mapcounts[pfn] >= 2) {
+                // don't swap out the page frame being copied from
+                unsigned int new_pfn = find_smallest_pfn(pfn);
+                if(new_pfn == NR_PAGEFRAMES) {
+                    return false;
+                }
+                copy_page_content(new_pfn, pfn);
+                put_page(pfn, pte);
+                pfn = new_pfn;
+                set_pte(pte, pfn, flags);
+                get_page(pfn, pte);
+                // the old translation points to the shared frame
+                invalidate_tlb(current_asid(), vpn);
+                count_event(cow_copies);
                 return true;
             }
         }
     }
 
     //이거는 에러임
-    fprintf(stderr, "error\n");
+    pr_result("error\n");
     return false;
 }
 
 
+/**
+ * Processes in @processes are also hashed by their pids to find the process
+ * to switch to without scanning the list. The table grows as the number of
+ * processes increases.
+ */
+static struct hlist_head *pid_hash = NULL;
+static unsigned int pid_hash_bits = 0;
+static unsigned int nr_hashed = 0;
+static unsigned long ready_clock = 0;
+
+// switching to the pid of the current process forks another process with
+// the same pid. so address space IDs are given separately
+static unsigned int last_asid = 0;
+
+static inline struct hlist_head *pid_hash_head(unsigned int pid)
+{
+    return &pid_hash[(pid * 0x9e3779b9U) >> (32 - pid_hash_bits)];
+}
+
+static void pid_hash_grow(void)
+{
+    struct hlist_head *old = pid_hash;
+    unsigned int old_size = old ? (1U << pid_hash_bits) : 0;
+
+    pid_hash_bits = old ? pid_hash_bits + 1 : 6;
+    pid_hash = calloc(1U << pid_hash_bits, sizeof(*pid_hash));
+
+    for (unsigned int i = 0; i < old_size; i++) {
+        while (old[i].first) {
+            struct process *p = hlist_entry(old[i].first, struct process, hash);
+
+            hlist_del(&p->hash);
+            hlist_add_head(&p->hash, pid_hash_head(p->pid));
+        }
+    }
+    free(old);
+}
+
+// put @p at the tail of the ready queue
+static void enqueue_process(struct process *p)
+{
+    if (!pid_hash || nr_hashed >= (1U << pid_hash_bits)) {
+        pid_hash_grow();
+    }
+
+    p->ready_seq = ++ready_clock;
+    list_add_tail(&p->list, &processes);
+    hlist_add_head(&p->hash, pid_hash_head(p->pid));
+    nr_hashed++;
+}
+
+static void dequeue_process(struct process *p)
+{
+    list_del_init(&p->list);
+    hlist_del_init(&p->hash);
+    nr_hashed--;
+}
+
+// find the process with @pid that comes first in the ready queue
+static struct process *find_process(unsigned int pid)
+{
+    struct process *found = NULL;
+    struct hlist_node *node;
+
+    if (!pid_hash) return NULL;
+
+    for (node = pid_hash_head(pid)->first; node; node = node->next) {
+        struct process *p = hlist_entry(node, struct process, hash);
+
+        if (p->pid != pid) continue;
+        if (!found || p->ready_seq < found->ready_seq) found = p;
+    }
+    return found;
+}
+
+/**
+ * struct process are allocated from this cache on fork
+ */
+static struct slab_cache process_cache =
+        SLAB_CACHE_INIT("process", sizeof(struct process));
+
+// the initial process of the framework is not from the cache, but is freed
+// to the cache on exit like the forked ones
+void init_processes(void)
+{
+    slab_adopt(&process_cache, 1);
+}
+
 /**
  * switch_process()
  *
@@ -283,68 +845,149 @@ bool handle_page_fault(unsigned int vpn, unsigned int rw)
  *   the identical page table entry 'values' to its parent's (i.e., @current)
  *   page table. 
  *   To implement the copy-on-write feature, you should manipulate the writable
- *   bit in PTE and mapcounts for shared pages. You may use pte->private for 
- *   storing some useful information :-)
+ *   bit in PTE and mapcounts for shared pages. The child gets a copy of the
+ *   areas of the parent, which tell the pages that were writable before the
+ *   fork.
  */
 
 // 원래 read였던것은 fork후에도 read만해야함
 // 원래 write였던것은 fork후에도 write가능
-// private에 write가능하다고 표시
 
-//On a context switch, TLB should be flushed
-//– Each process has its own VA to PA mapping
-//– Thus, cannot share TLB entries between processes
+// TLB entries are tagged with the ASID of the process (current_asid()), so
+// no need to flush TLB on context switches. each forked process takes the
+// next ASID even if it reuses a pid, and ASIDs are never recycled: a killed
+// process drops its TLB entries, and restoring a checkpoint goes on after
+// the largest ASID restored. so stale entries never match another process
+
+// processes running on the other CPUs are not in the ready queue, so
+// switching to them forks another process with the pid. idle CPUs start
+// a new process with an empty address space instead of forking
 void switch_process(unsigned int pid)
 {
-    memset(tlb, 0, sizeof(tlb));
     // 프로세스 리스트 찾아서 있으면 변경
-    struct process *p, *cursor = NULL;
-
-    list_for_each_entry_safe(p, cursor,&processes,list) {
-        if(p->pid == pid) {
-            list_add_tail(&current->list,&processes);
-            current = p;
-            ptbr = &(p->pagetable);
-            list_del_init(&p->list);
-            goto exit;
-        }
+    struct process *p = find_process(pid);
+
+    count_event(switches);
+
+    if(p) {
+        dequeue_process(p);
+        if (current) enqueue_process(current);
+        current = p;
+        ptbr = &(p->pagetable);
+        goto exit;
     }
 
     // 프로세스 리스트에 없으면 새로 생성
-    struct process *next =(struct process*)malloc(sizeof(struct process));
-    struct pagetable* nextPtbr = &(next->pagetable);
-    for(int i = 0 ; i < NR_PTES_PER_PAGE ; i++) {
-        if(!ptbr->outer_ptes[i]) {
-            continue;
-        } else {
-            next->pagetable.outer_ptes[i] = malloc(sizeof(struct pte_directory)*NR_PTES_PER_PAGE);
-        }
+    // parent's pages become write-protected for copy-on-write. Cached
+    // translations could let the parent write to the shared frames.
+    if (current) {
+        flush_tlb_asid(current_asid());
+        count_event(forks);
+    }
 
-        for (int j = 0 ; j < NR_PTES_PER_PAGE ;j++) {
-            if (ptbr->outer_ptes[i]->ptes[j].valid) {
-                struct pte forkedPte = ptbr->outer_ptes[i]->ptes[j];
-                mapcounts[ptbr->outer_ptes[i]->ptes[j].pfn]++;
-                //원래 read만 가능한것이었으면 read만 가능했다고 표시
-                if (ptbr->outer_ptes[i]->ptes[j].writable == 0) {
-                    forkedPte.private = ptbr->outer_ptes[i]->ptes[j].private;
-                }
-                // copy on write
-                ptbr->outer_ptes[i]->ptes[j].writable = false;
-                forkedPte.valid = true;
-                forkedPte.writable = false;
-                forkedPte.pfn = ptbr->outer_ptes[i]->ptes[j].pfn;
-                nextPtbr->outer_ptes[i]->ptes[j] = forkedPte;
-            }       
-        }
+    struct process *next = slab_alloc(&process_cache);
+    struct pagetable* nextPtbr = &(next->pagetable);
+    init_pagetable(nextPtbr);
+    // share the page directories. They are copied when updated later
+    if (current) {
+        share_pagetable(nextPtbr, ptbr);
+        copy_vmas(&next->vmas, &current->vmas);
     }
     next->pid = pid;
-    next->list = current->list;
-    list_add_tail(&current->list,&processes);
+    next->asid = ++last_asid;
+    next->cpumask = 0;
+    // the page frames of the process are allocated near the CPU forking it
+    next->home_node = cpu_to_node(this_cpu);
+    next->next_node = next->home_node;
+    INIT_LIST_HEAD(&next->list);
+    if (current) enqueue_process(current);
     current = next;
     ptbr = nextPtbr;
 
     exit:
+    // translations of the process may be cached on this CPU from now on
+    current->cpumask |= cpu_bit(this_cpu);
     return;
 }
 
 
+/**
+ * exit_process(@pid)
+ *
+ * DESCRIPTION
+ *   Terminate the process with @pid. The current process comes first, and
+ *   then the one in the ready queue, and then the ones running on the other
+ *   CPUs. The CPU running the process becomes idle. The pages and the
+ *   directories of the process are released in a single walk of its page
+ *   table, and its cached translations are dropped on all CPUs that have
+ *   run it.
+ *
+ * RETURN
+ *   @true if the process is terminated
+ *   @false if there is no process with @pid
+ */
+bool exit_process(unsigned int pid)
+{
+    struct process *p = NULL;
+
+    if (current && current->pid == pid) {
+        p = current;
+        current = NULL;
+        ptbr = NULL;
+    } else if ((p = find_process(pid))) {
+        dequeue_process(p);
+    } else {
+        for (unsigned int cpu = 0; cpu < nr_cpus; cpu++) {
+            if (cpu == this_cpu || !cpus[cpu].current) continue;
+            if (cpus[cpu].current->pid != pid) continue;
+
+            p = cpus[cpu].current;
+            cpus[cpu].current = NULL;
+            cpus[cpu].ptbr = NULL;
+            break;
+        }
+        if (!p) return false;
+    }
+
+    // the leaf directories cached by the MMU go away with the page table
+    flush_tlb_process(p);
+    free_pagetable(&p->pagetable);
+    free_vmas(&p->vmas);
+    slab_free(&process_cache, p);
+    count_event(exits);
+    return true;
+}
+
+
+/**
+ * restore_processes(@procs, @nr_procs, @nr_ready, @tlb_stamp)
+ *
+ * DESCRIPTION
+ *   The framework restored @nr_procs processes in @procs from a checkpoint,
+ *   and the first @nr_ready of them are in the ready queue in order. The
+ *   others are running on the CPUs. The processes before the restore are
+ *   gone. The TLB entries restored are stamped or ranked up to @tlb_stamp.
+ */
+void restore_processes(struct process *procs, unsigned int nr_procs,
+        unsigned int nr_ready, unsigned long tlb_stamp)
+{
+    INIT_LIST_HEAD(&processes);
+    free(pid_hash);
+    pid_hash = NULL;
+    nr_hashed = 0;
+
+    // the restored processes are freed to the cache like the forked ones
+    destroy_slab_cache(&process_cache);
+    slab_adopt(&process_cache, nr_procs);
+
+    last_asid = 0;
+    for (unsigned int i = 0; i < nr_procs; i++) {
+        INIT_LIST_HEAD(&procs[i].list);
+        INIT_HLIST_NODE(&procs[i].hash);
+        if (procs[i].asid > last_asid) last_asid = procs[i].asid;
+    }
+    for (unsigned int i = 0; i < nr_ready; i++) {
+        enqueue_process(&procs[i]);
+    }
+    tlb_clock = tlb_stamp;
+}
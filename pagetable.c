@@ -0,0 +1,582 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "pagetable.h"
+#include "slab.h"
+#include "frame.h"
+#include "stats.h"
+#include "swap.h"
+
+/**
+ * Directories are allocated from the slab caches. Leaf directories holding
+ * PTEs and the upper-level directories holding pointers differ in size.
+ */
+static struct slab_cache outer_cache;
+static struct slab_cache dir_cache;
+static struct slab_cache leaf_cache;
+static struct slab_cache huge_cache;
+
+void init_pagetable_caches(void)
+{
+	/* Directories restored over are dropped */
+	destroy_slab_cache(&outer_cache);
+	destroy_slab_cache(&dir_cache);
+	destroy_slab_cache(&leaf_cache);
+	destroy_slab_cache(&huge_cache);
+
+	init_slab_cache(&outer_cache, "outer_ptes",
+			sizeof(struct pte_directory *) * NR_PTES_PER_PAGE);
+	init_slab_cache(&dir_cache, "pte_directory", PTE_DIRECTORY_SIZE(1));
+	init_slab_cache(&leaf_cache, "pte_directory_leaf", PTE_DIRECTORY_SIZE(0));
+	init_slab_cache(&huge_cache, "huge_ptes",
+			sizeof(struct pte) * NR_PTES_PER_PAGE);
+}
+
+static struct pte_directory *alloc_pte_directory(unsigned int level)
+{
+	struct pte_directory *pd = slab_alloc(level ? &dir_cache : &leaf_cache);
+
+	pd->refcount = 1;
+	return pd;
+}
+
+static void free_pte_directory(struct pte_directory *pd, unsigned int level)
+{
+	slab_free(level ? &dir_cache : &leaf_cache, pd);
+}
+
+unsigned long pagetable_memory(unsigned long *nr_directories)
+{
+	if (nr_directories) {
+		*nr_directories = dir_cache.nr_active + leaf_cache.nr_active;
+	}
+	return outer_cache.nr_active * outer_cache.size +
+		dir_cache.nr_active * dir_cache.size +
+		leaf_cache.nr_active * leaf_cache.size +
+		huge_cache.nr_active * huge_cache.size;
+}
+
+void init_pagetable(struct pagetable *pt)
+{
+	pt->outer_ptes = slab_alloc(&outer_cache);
+	pt->huge_ptes = NULL;
+}
+
+/**
+ * Duplicate a PTE of a shared leaf directory. Both PTEs map the same page
+ * frame (or swap slot), so writable pages are write-protected for
+ * copy-on-write. The areas of the processes tell which pages are copied
+ * on write.
+ */
+static void __copy_pte(struct pte *dst, struct pte *src)
+{
+	if (pte_swapped(src)) {
+		swap_duplicate(pte_swap_slot(src));
+	} else {
+		get_page(pte_pfn(src), dst);
+	}
+
+	pte_clear_flags(src, PTE_WRITABLE);
+	*dst = *src;
+}
+
+/**
+ * __unshare_directory(@pd, @level)
+ *
+ * DESCRIPTION
+ *   Make a private copy of shared @pd at @level. The lower-level directories
+ *   become shared by the copy, and the PTEs are duplicated for copy-on-write.
+ */
+static struct pte_directory *__unshare_directory(struct pte_directory *pd,
+		unsigned int level)
+{
+	struct pte_directory *copy = alloc_pte_directory(level);
+
+	copy->nr_used = pd->nr_used;
+
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (level == 0) {
+			if (!pte_none(&pd->ptes[i])) __copy_pte(&copy->ptes[i], &pd->ptes[i]);
+		} else if (pd->dirs[i]) {
+			copy->dirs[i] = pd->dirs[i];
+			copy->dirs[i]->refcount++;
+		}
+	}
+
+	pd->refcount--;
+	count_event(dir_unshares);
+	return copy;
+}
+
+/**
+ * Slot in the directory at @level + 1 that points to the directory at @level
+ */
+static struct pte_directory **__dir_slot(struct pagetable *pt,
+		struct pte_directory **path, unsigned int vpn, unsigned int level)
+{
+	if (level == nr_pt_levels - 2) {
+		return &pt->outer_ptes[pt_index(vpn, level + 1)];
+	}
+	return &path[level + 1]->dirs[pt_index(vpn, level + 1)];
+}
+
+/**
+ * __walk_private(@pt, @vpn, @alloc, @path)
+ *
+ * DESCRIPTION
+ *   Walk down to the leaf directory for @vpn while unsharing the directories
+ *   on the way. Missing directories are allocated if @alloc is set. @path
+ *   is filled with the directories at each level.
+ *
+ * RETURN
+ *   @true if the leaf directory is reached
+ */
+static bool __walk_private(struct pagetable *pt, unsigned int vpn, bool alloc,
+		struct pte_directory **path)
+{
+	for (int level = nr_pt_levels - 2; level >= 0; level--) {
+		struct pte_directory **slot = __dir_slot(pt, path, vpn, level);
+
+		if (!*slot) {
+			if (!alloc) return false;
+
+			*slot = alloc_pte_directory(level);
+			if (level < nr_pt_levels - 2) path[level + 1]->nr_used++;
+		} else if (pte_directory_shared(*slot)) {
+			*slot = __unshare_directory(*slot, level);
+		}
+		path[level] = *slot;
+	}
+	return true;
+}
+
+struct pte *populate_pte(struct pagetable *pt, unsigned int vpn)
+{
+	struct pte_directory *path[MAX_PT_LEVELS];
+	struct pte *pte;
+
+	__walk_private(pt, vpn, true, path);
+
+	pte = &path[0]->ptes[pt_index(vpn, 0)];
+	if (pte_none(pte)) path[0]->nr_used++;
+
+	return pte;
+}
+
+struct pte *unshare_pte(struct pagetable *pt, unsigned int vpn)
+{
+	struct pte_directory *path[MAX_PT_LEVELS];
+
+	if (!__walk_private(pt, vpn, false, path)) return NULL;
+
+	return &path[0]->ptes[pt_index(vpn, 0)];
+}
+
+void depopulate_pte(struct pagetable *pt, unsigned int vpn)
+{
+	struct pte_directory *path[MAX_PT_LEVELS];
+
+	for (int level = nr_pt_levels - 2; level >= 0; level--) {
+		path[level] = *__dir_slot(pt, path, vpn, level);
+		assert(path[level] && !pte_directory_shared(path[level]));
+	}
+
+	for (int level = 0; level <= nr_pt_levels - 2; level++) {
+		assert(path[level]->nr_used);
+
+		if (--path[level]->nr_used) break;
+
+		*__dir_slot(pt, path, vpn, level) = NULL;
+		free_pte_directory(path[level], level);
+	}
+}
+
+struct pte *populate_huge_pte(struct pagetable *pt, unsigned int vpn)
+{
+	assert(huge_page_unused(pt, vpn));
+
+	if (!pt->huge_ptes) pt->huge_ptes = slab_alloc(&huge_cache);
+
+	return &pt->huge_ptes[pt_index(vpn, nr_pt_levels - 1)];
+}
+
+void split_huge_pte(struct pagetable *pt, unsigned int vpn)
+{
+	struct pte *huge = lookup_huge_pte(pt, vpn);
+	unsigned int pfn = pte_pfn(huge);
+	unsigned int flags = pte_flags(huge) & ~PTE_HUGE;
+	unsigned int first = vpn & ~(NR_HUGE_PAGE_PAGES - 1);
+
+	/* Map the page frames with the new PTEs before releasing the huge PTE */
+	for (unsigned int i = 0; i < NR_HUGE_PAGE_PAGES; i++) {
+		struct pte *pte = populate_pte(pt, first + i);
+
+		set_pte(pte, pfn + i, flags);
+		get_page(pfn + i, pte);
+		put_page(pfn + i, huge);
+	}
+	clear_pte(huge);
+	count_event(huge_splits);
+}
+
+void share_pagetable(struct pagetable *dst, struct pagetable *src)
+{
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!src->outer_ptes[i]) continue;
+
+		dst->outer_ptes[i] = src->outer_ptes[i];
+		dst->outer_ptes[i]->refcount++;
+	}
+
+	if (!src->huge_ptes) return;
+
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		struct pte *src_pte = &src->huge_ptes[i];
+		struct pte *dst_pte;
+
+		if (!pte_huge(src_pte)) continue;
+
+		pte_clear_flags(src_pte, PTE_WRITABLE);
+		dst_pte = populate_huge_pte(dst, i << HUGE_PAGE_SHIFT);
+		*dst_pte = *src_pte;
+
+		for (unsigned int j = 0; j < NR_HUGE_PAGE_PAGES; j++) {
+			get_page(pte_pfn(src_pte) + j, dst_pte);
+		}
+	}
+}
+
+/**
+ * Drop a reference to @pd at @level. The pages mapped only through @pd are
+ * released with it when the reference is the last one.
+ */
+static void __free_directory(struct pte_directory *pd, unsigned int level)
+{
+	if (--pd->refcount) return;
+
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		struct pte *pte = &pd->ptes[i];
+
+		if (level) {
+			if (pd->dirs[i]) __free_directory(pd->dirs[i], level - 1);
+		} else if (pte_swapped(pte)) {
+			swap_free(pte_swap_slot(pte));
+		} else if (pte_valid(pte)) {
+			put_page(pte_pfn(pte), pte);
+		}
+	}
+	free_pte_directory(pd, level);
+}
+
+void free_pagetable(struct pagetable *pt)
+{
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (pt->outer_ptes[i]) {
+			__free_directory(pt->outer_ptes[i], nr_pt_levels - 2);
+		}
+	}
+	slab_free(&outer_cache, pt->outer_ptes);
+	pt->outer_ptes = NULL;
+
+	if (!pt->huge_ptes) return;
+
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		struct pte *huge = &pt->huge_ptes[i];
+
+		if (!pte_huge(huge)) continue;
+
+		for (unsigned int j = 0; j < NR_HUGE_PAGE_PAGES; j++) {
+			put_page(pte_pfn(huge) + j, huge);
+		}
+	}
+	slab_free(&huge_cache, pt->huge_ptes);
+	pt->huge_ptes = NULL;
+}
+
+static void __for_each_directory(struct pte_directory *pd, unsigned int level,
+		unsigned int *index, bool shared,
+		void (*fn)(struct pte_directory *, unsigned int *, bool, void *),
+		void *data)
+{
+	shared |= pte_directory_shared(pd);
+
+	if (level == 0) {
+		fn(pd, index, shared, data);
+		return;
+	}
+
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!pd->dirs[i]) continue;
+
+		index[nr_pt_levels - 1 - level] = i;
+		__for_each_directory(pd->dirs[i], level - 1, index, shared, fn, data);
+	}
+}
+
+void for_each_pte_directory(struct pagetable *pt,
+		void (*fn)(struct pte_directory *pd, unsigned int *index, bool shared,
+				void *data),
+		void *data)
+{
+	unsigned int index[MAX_PT_LEVELS];
+
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (!pt->outer_ptes[i]) continue;
+
+		index[0] = i;
+		__for_each_directory(pt->outer_ptes[i], nr_pt_levels - 2, index,
+				false, fn, data);
+	}
+}
+
+
+/**
+ * Objects of the page tables to be saved. @index maps each object to its
+ * kind and the position among the objects of the kind, so that the
+ * directories shared by fork are saved once.
+ */
+struct pt_object {
+	void *obj;
+	enum pagetable_object kind;
+	uint64_t nr;			/* Position in the objects of @kind */
+};
+
+struct pt_objects {
+	struct pt_object *index;	/* Open addressing by @obj */
+	unsigned long index_size;
+	unsigned long nr;
+	void **objs[NR_PT_OBJECTS];	/* In the order of saving */
+	uint64_t nr_objs[NR_PT_OBJECTS];
+	uint64_t offsets[NR_PT_OBJECTS];	/* of each kind in the file */
+};
+
+static struct slab_cache *__object_cache(enum pagetable_object kind)
+{
+	static struct slab_cache *caches[] = {
+		[PT_OUTER] = &outer_cache,
+		[PT_DIR] = &dir_cache,
+		[PT_LEAF] = &leaf_cache,
+		[PT_HUGE] = &huge_cache,
+	};
+	return caches[kind];
+}
+
+static inline unsigned long __hash_object(void *obj, unsigned long size)
+{
+	return ((uintptr_t)obj * 0x9e3779b97f4a7c15ULL) >> 7 & (size - 1);
+}
+
+static struct pt_object *__find_object(struct pt_objects *objs, void *obj)
+{
+	unsigned long i = __hash_object(obj, objs->index_size);
+
+	while (objs->index[i].obj && objs->index[i].obj != obj) {
+		i = (i + 1) & (objs->index_size - 1);
+	}
+	return &objs->index[i];
+}
+
+/* Add @obj of @kind if it is not added yet. Return @false if it is */
+static bool __add_object(struct pt_objects *objs, void *obj,
+		enum pagetable_object kind)
+{
+	struct pt_object *o;
+
+	if (objs->nr * 2 >= objs->index_size) {
+		struct pt_object *old = objs->index;
+		unsigned long old_size = objs->index_size;
+
+		objs->index_size = old_size ? old_size * 2 : 1024;
+		objs->index = calloc(objs->index_size, sizeof(*objs->index));
+		for (unsigned long i = 0; i < old_size; i++) {
+			if (old[i].obj) *__find_object(objs, old[i].obj) = old[i];
+		}
+		free(old);
+	}
+
+	o = __find_object(objs, obj);
+	if (o->obj) return false;
+
+	/* The number of objects of a kind doubles each time it is filled up */
+	if (!(objs->nr_objs[kind] & (objs->nr_objs[kind] - 1))) {
+		objs->objs[kind] = realloc(objs->objs[kind],
+				sizeof(void *) * (objs->nr_objs[kind] ? objs->nr_objs[kind] * 2 : 1));
+	}
+
+	*o = (struct pt_object) { .obj = obj, .kind = kind, .nr = objs->nr_objs[kind] };
+	objs->objs[kind][objs->nr_objs[kind]++] = obj;
+	objs->nr++;
+	return true;
+}
+
+static void __add_directory(struct pt_objects *objs, struct pte_directory *pd,
+		unsigned int level)
+{
+	if (!__add_object(objs, pd, level ? PT_DIR : PT_LEAF) || level == 0) return;
+
+	for (unsigned int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		if (pd->dirs[i]) __add_directory(objs, pd->dirs[i], level - 1);
+	}
+}
+
+/* Offset of @obj in the file, stored in place of the pointer */
+static void *__object_offset(struct pt_objects *objs, void *obj)
+{
+	struct pt_object *o;
+
+	if (!obj) return NULL;
+
+	o = __find_object(objs, obj);
+	assert(o->obj);
+	return (void *)(uintptr_t)(objs->offsets[o->kind] +
+			o->nr * slab_object_size(__object_cache(o->kind)));
+}
+
+bool save_pagetables(FILE *file, struct pagetable **pts, unsigned int nr_pts,
+		struct pagetable_image *image)
+{
+	struct pt_objects objs = { .index = NULL };
+	uint64_t offset = image->offset;
+	void *buffer = NULL;
+	bool ret = true;
+
+	for (unsigned int i = 0; i < nr_pts; i++) {
+		__add_object(&objs, pts[i]->outer_ptes, PT_OUTER);
+		if (pts[i]->huge_ptes) __add_object(&objs, pts[i]->huge_ptes, PT_HUGE);
+
+		for (unsigned int j = 0; j < NR_PTES_PER_PAGE; j++) {
+			struct pte_directory *pd = pts[i]->outer_ptes[j];
+
+			if (pd) __add_directory(&objs, pd, nr_pt_levels - 2);
+		}
+	}
+
+	for (int kind = 0; kind < NR_PT_OBJECTS; kind++) {
+		objs.offsets[kind] = offset;
+		offset += objs.nr_objs[kind] * slab_object_size(__object_cache(kind));
+		image->nr_objects[kind] = objs.nr_objs[kind];
+	}
+	image->size = offset - image->offset;
+
+	/* Copy each object to replace its pointers with the offsets */
+	buffer = malloc(slab_object_size(&dir_cache) > slab_object_size(&outer_cache) ?
+			slab_object_size(&dir_cache) : slab_object_size(&outer_cache));
+
+	for (int kind = 0; kind < NR_PT_OBJECTS && ret; kind++) {
+		size_t size = slab_object_size(__object_cache(kind));
+
+		for (uint64_t i = 0; i < objs.nr_objs[kind] && ret; i++) {
+			void *obj = objs.objs[kind][i];
+
+			if (kind == PT_OUTER || kind == PT_DIR) {
+				struct pte_directory **slots;
+
+				memcpy(buffer, obj, size);
+				slots = kind == PT_OUTER ? buffer :
+						((struct pte_directory *)buffer)->dirs;
+				for (unsigned int j = 0; j < NR_PTES_PER_PAGE; j++) {
+					slots[j] = __object_offset(&objs, slots[j]);
+				}
+				obj = buffer;
+			}
+			ret = fwrite(obj, size, 1, file) == 1;
+		}
+	}
+
+	for (unsigned int i = 0; i < nr_pts; i++) {
+		pts[i]->outer_ptes = __object_offset(&objs, pts[i]->outer_ptes);
+		pts[i]->huge_ptes = __object_offset(&objs, pts[i]->huge_ptes);
+	}
+
+	free(buffer);
+	for (int kind = 0; kind < NR_PT_OBJECTS; kind++) free(objs.objs[kind]);
+	free(objs.index);
+	return ret;
+}
+
+bool valid_pagetable_image(const struct pagetable_image *image)
+{
+	uint64_t size = 0;
+
+	for (int kind = 0; kind < NR_PT_OBJECTS; kind++) {
+		size += image->nr_objects[kind] * slab_object_size(__object_cache(kind));
+	}
+	return size == image->size;
+}
+
+static inline void *__object_pointer(void *base, void *offset)
+{
+	return offset ? (char *)base + (uintptr_t)offset : NULL;
+}
+
+void restore_pagetables(void *base, const struct pagetable_image *image,
+		struct pagetable **pts, unsigned int nr_pts)
+{
+	char *obj = (char *)base + image->offset;
+
+	init_pagetable_caches();
+
+	for (int kind = 0; kind < NR_PT_OBJECTS; kind++) {
+		struct slab_cache *cache = __object_cache(kind);
+		size_t size = slab_object_size(cache);
+
+		for (uint64_t i = 0; i < image->nr_objects[kind]; i++, obj += size) {
+			struct pte_directory *pd = (struct pte_directory *)obj;
+			struct pte_directory **slots = (struct pte_directory **)obj;
+			struct pte *ptes = (struct pte *)obj;
+
+			switch (kind) {
+			case PT_DIR:
+				slots = pd->dirs;
+				/* fall through */
+			case PT_OUTER:
+				for (unsigned int j = 0; j < NR_PTES_PER_PAGE; j++) {
+					slots[j] = __object_pointer(base, slots[j]);
+				}
+				break;
+			case PT_LEAF:
+				for (unsigned int j = 0; j < NR_PTES_PER_PAGE; j++) {
+					if (pte_valid(&pd->ptes[j])) {
+						restore_rmap(pte_pfn(&pd->ptes[j]), &pd->ptes[j]);
+					}
+				}
+				break;
+			case PT_HUGE:
+				for (unsigned int j = 0; j < NR_PTES_PER_PAGE; j++) {
+					if (!pte_huge(&ptes[j])) continue;
+
+					for (unsigned int k = 0; k < NR_HUGE_PAGE_PAGES; k++) {
+						restore_rmap(pte_pfn(&ptes[j]) + k, &ptes[j]);
+					}
+				}
+				break;
+			}
+		}
+		slab_adopt(cache, image->nr_objects[kind]);
+	}
+
+	for (unsigned int i = 0; i < nr_pts; i++) {
+		pts[i]->outer_ptes = __object_pointer(base, pts[i]->outer_ptes);
+		pts[i]->huge_ptes = __object_pointer(base, pts[i]->huge_ptes);
+	}
+}
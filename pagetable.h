@@ -0,0 +1,291 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __PAGETABLE_H__
+#define __PAGETABLE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * N-level radix page table walker.
+ *
+ * The outermost level, @outer_ptes in struct pagetable, is at level
+ * (nr_pt_levels - 1) and always exists. Lower directories are allocated on
+ * demand, and level 0 directories hold PTEs. A directory is reclaimed when
+ * it has no entry in use.
+ *
+ * Forked page tables share the directories with their parents. A directory
+ * referenced by more than one upper-level slot is shared, and all accesses
+ * for write through it are rejected until the directory is copied for the
+ * page table to update it.
+ *
+ * An outer entry may map a huge page instead, which is an aligned run of
+ * NR_HUGE_PAGE_PAGES page frames. Huge pages are kept in @huge_ptes of
+ * struct pagetable, and the outer entry has no directory while its huge PTE
+ * is in use. Huge pages are copied on fork like the PTEs, and are split into
+ * the regular PTEs when a part of the huge page should be updated.
+ */
+#define MAX_PT_LEVELS	8
+
+/**
+ * Index of @vpn in the directory at @level
+ */
+static inline unsigned int pt_index(unsigned int vpn, unsigned int level)
+{
+	return (vpn >> (level * PTES_PER_PAGE_SHIFT)) & PTE_INDEX_MASK;
+}
+
+void init_pagetable_caches(void);
+void init_pagetable(struct pagetable *pt);
+
+/**
+ * pagetable_memory(@nr_directories)
+ *
+ * RETURN
+ *   Bytes taken by the page tables of all processes. The number of
+ *   directories in use is stored to @nr_directories unless it is NULL.
+ */
+unsigned long pagetable_memory(unsigned long *nr_directories);
+
+static inline bool pte_directory_shared(struct pte_directory *pd)
+{
+	return pd->refcount > 1;
+}
+
+/**
+ * lookup_pte_directory(@pt, @vpn, @shared)
+ *
+ * DESCRIPTION
+ *   Walk down @pt to find the leaf directory holding the PTE for @vpn. If
+ *   @shared is not NULL, it is set when any directory on the way is shared
+ *   with other page tables.
+ *
+ * RETURN
+ *   Leaf directory for @vpn in @pt
+ *   NULL if any directory on the way does not exist
+ */
+static inline struct pte_directory *lookup_pte_directory(struct pagetable *pt,
+		unsigned int vpn, bool *shared)
+{
+	struct pte_directory *pd = pt->outer_ptes[pt_index(vpn, nr_pt_levels - 1)];
+	bool is_shared = false;
+
+	if (!pd) return NULL;
+	is_shared = pte_directory_shared(pd);
+
+	for (int level = nr_pt_levels - 2; level > 0; level--) {
+		pd = pd->dirs[pt_index(vpn, level)];
+		if (!pd) return NULL;
+		is_shared |= pte_directory_shared(pd);
+	}
+
+	if (shared) *shared = is_shared;
+	return pd;
+}
+
+/**
+ * lookup_pte(@pt, @vpn, @shared)
+ *
+ * DESCRIPTION
+ *   Same as lookup_pte_directory(), but get the PTE for @vpn.
+ *
+ * RETURN
+ *   PTE for @vpn in @pt
+ *   NULL if any directory on the way to the PTE does not exist
+ */
+static inline struct pte *lookup_pte(struct pagetable *pt, unsigned int vpn,
+		bool *shared)
+{
+	struct pte_directory *pd = lookup_pte_directory(pt, vpn, shared);
+
+	return pd ? &pd->ptes[pt_index(vpn, 0)] : NULL;
+}
+
+/**
+ * lookup_huge_pte(@pt, @vpn)
+ *
+ * RETURN
+ *   The huge PTE covering @vpn in @pt
+ *   NULL if @vpn is not mapped by a huge page
+ */
+static inline struct pte *lookup_huge_pte(struct pagetable *pt, unsigned int vpn)
+{
+	struct pte *pte;
+
+	if (!pt->huge_ptes) return NULL;
+
+	pte = &pt->huge_ptes[pt_index(vpn, nr_pt_levels - 1)];
+	return pte_huge(pte) ? pte : NULL;
+}
+
+/**
+ * huge_page_unused(@pt, @vpn)
+ *
+ * RETURN
+ *   @true if no page in the huge page covering @vpn is in use in @pt
+ */
+static inline bool huge_page_unused(struct pagetable *pt, unsigned int vpn)
+{
+	return !pt->outer_ptes[pt_index(vpn, nr_pt_levels - 1)] &&
+		!lookup_huge_pte(pt, vpn);
+}
+
+/**
+ * populate_huge_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Get the huge PTE for @vpn to make it valid. The huge page should be
+ *   unused.
+ */
+struct pte *populate_huge_pte(struct pagetable *pt, unsigned int vpn);
+
+/**
+ * split_huge_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Replace the huge PTE covering @vpn with the regular PTEs mapping the
+ *   same page frames with the same permission. The TLB entry for the huge
+ *   page should be invalidated by the caller.
+ */
+void split_huge_pte(struct pagetable *pt, unsigned int vpn);
+
+/**
+ * populate_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Get the PTE for @vpn to make it valid. Allocate directories on the way
+ *   if they do not exist yet, and copy those shared with other page tables.
+ *   The PTE is accounted as in use.
+ */
+struct pte *populate_pte(struct pagetable *pt, unsigned int vpn);
+
+/**
+ * unshare_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   Copy the shared directories on the way to the PTE for @vpn so that the
+ *   PTE can be updated without affecting other page tables. The PTEs in the
+ *   copied leaf directory map the same page frames for copy-on-write.
+ *
+ * RETURN
+ *   PTE for @vpn in @pt
+ *   NULL if any directory on the way to the PTE does not exist
+ */
+struct pte *unshare_pte(struct pagetable *pt, unsigned int vpn);
+
+/**
+ * depopulate_pte(@pt, @vpn)
+ *
+ * DESCRIPTION
+ *   The PTE for @vpn has been invalidated. Release the directories on the way
+ *   if they become empty. The directories should have been unshared.
+ */
+void depopulate_pte(struct pagetable *pt, unsigned int vpn);
+
+/**
+ * share_pagetable(@dst, @src)
+ *
+ * DESCRIPTION
+ *   Make empty @dst share the directories of @src for fork. This takes
+ *   O(NR_PTES_PER_PAGE) regardless of the number of mapped pages. Huge
+ *   pages are duplicated for copy-on-write.
+ */
+void share_pagetable(struct pagetable *dst, struct pagetable *src);
+
+/**
+ * free_pagetable(@pt)
+ *
+ * DESCRIPTION
+ *   Release all pages mapped by @pt and its directories in a single walk,
+ *   for the process to exit. Directories shared with other page tables are
+ *   left to them along with their pages, so the protection of the pages
+ *   copied on write is untouched; the last one mapping a page frame gets it
+ *   writable on its next write fault.
+ */
+void free_pagetable(struct pagetable *pt);
+
+/**
+ * for_each_pte_directory(@pt, @fn, @data)
+ *
+ * DESCRIPTION
+ *   Call @fn for each leaf directory in @pt in the ascending VPN order.
+ *   @index holds the indices of the directory at each level, from the
+ *   outermost one. @shared is set if any directory on the way is shared.
+ */
+void for_each_pte_directory(struct pagetable *pt,
+		void (*fn)(struct pte_directory *pd, unsigned int *index, bool shared,
+				void *data),
+		void *data);
+
+/**
+ * Page tables in checkpoints. The image of the page tables consists of the
+ * outer directories, the upper-level directories, the leaf directories, and
+ * the huge PTE arrays in a row. The pointers in the image are replaced with
+ * the offsets in the checkpoint file so that the image is restored in place.
+ * Directories shared by fork are saved once.
+ */
+enum pagetable_object {
+	PT_OUTER = 0,
+	PT_DIR,
+	PT_LEAF,
+	PT_HUGE,
+	NR_PT_OBJECTS,
+};
+
+struct pagetable_image {
+	uint64_t offset;	/* of the image in the checkpoint file */
+	uint64_t size;
+	uint64_t nr_objects[NR_PT_OBJECTS];
+};
+
+/**
+ * save_pagetables(@file, @pts, @nr_pts, @image)
+ *
+ * DESCRIPTION
+ *   Write the image of @nr_pts page tables in @pts to @file at
+ *   @image->offset, and fill in the rest of @image. The pointers in @pts are
+ *   replaced with the offsets of their directories in the file.
+ *
+ * RETURN
+ *   @true on success
+ */
+bool save_pagetables(FILE *file, struct pagetable **pts, unsigned int nr_pts,
+		struct pagetable_image *image);
+
+/**
+ * valid_pagetable_image(@image)
+ *
+ * RETURN
+ *   @true if the size of @image matches its objects in the current geometry
+ */
+bool valid_pagetable_image(const struct pagetable_image *image);
+
+/**
+ * restore_pagetables(@base, @image, @pts, @nr_pts)
+ *
+ * DESCRIPTION
+ *   Turn the offsets in the image and @pts back into pointers in place, where
+ *   the checkpoint file is mapped at @base. The directories built so far are
+ *   dropped, and those in the image are accounted to the page table caches.
+ *   The reverse maps of the page frames are rebuilt, so @mapcounts[] should
+ *   have been restored and init_frames() should have been called.
+ */
+void restore_pagetables(void *base, const struct pagetable_image *image,
+		struct pagetable **pts, unsigned int nr_pts);
+#endif
@@ -13,40 +13,38 @@
  *
  **********************************************************************/
 
-#include <string.h>
+#include <stddef.h>
 #include <ctype.h>
 
 #include "types.h"
 #include "parser.h"
 
-int parse_command(char *command, int *nr_tokens, char *tokens[])
+int lex_command(char *command, int *nr_tokens, char *tokens[])
 {
 	char *curr = command;
 	int token_started = false;
 	*nr_tokens = 0;
 
-	while (*curr != '\0') {
+	for (; *curr != '\0'; curr++) {
 		if (isspace(*curr)) {
 			*curr = '\0';
 			token_started = false;
-		} else {
-			if (!token_started) {
-				tokens[*nr_tokens] = curr;
-				*nr_tokens += 1;
-				token_started = true;
+			continue;
+		}
+		if (!token_started) {
+			/* Comments run to the end of the line */
+			if (*curr == '#') {
+				*curr = '\0';
+				break;
 			}
+			if (*nr_tokens < MAX_NR_TOKENS) tokens[*nr_tokens] = curr;
+			*nr_tokens += 1;
+			token_started = true;
 		}
-
-		curr++;
+		if (*nr_tokens == 1) *curr = tolower(*curr);
 	}
 
-	for (int i = 0; i < *nr_tokens; i++) {
-		if (strncmp(tokens[i], "#", strlen("#")) == 0) {
-			*nr_tokens = i;
-			tokens[i] = NULL;
-			break;
-		}
-	}
+	if (*nr_tokens < MAX_NR_TOKENS) tokens[*nr_tokens] = NULL;
 
 	return (*nr_tokens > 0);
 }
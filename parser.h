@@ -22,22 +22,27 @@
 
 
 /***********************************************************************
- * parse_command()
+ * lex_command()
  *
  * DESCRIPTION
- *  Parse @command, and put each command token into @tokens[] and the number of
- *  tokes into @nr_tokens. You may use this implemention or your own from PA0.
+ *  Split @command into @tokens[] in place and put the number of tokens into
+ *  @nr_tokens, in a single pass over @command. The first token, the command
+ *  name, is made lowercase on the way. The arguments are left as they are
+ *  since file names are case-sensitive.
  *
- *  A command token is defined as a string without any whitespace (i.e., *space*
- *  and *tab* in this programming assignment). For exmaple,
- *   command = "  cp  -pr /home/sslab   /path/to/dest  "
+ *  A command token is defined as a string without any whitespace. A token
+ *  starting with '#' begins a comment that runs to the end of @command. For
+ *  example,
+ *   command = "  ALLOC  0x10 rw   # comment"
  *
- *  then, nr_tokens = 4, and tokens is
- *    tokens[0] = "cp"
- *    tokens[1] = "-pr"
- *    tokens[2] = "/home/sslab"
- *    tokens[3] = "/path/to/dest"
- *    tokens[>=4] = NULL
+ *  then, nr_tokens = 3, and tokens is
+ *    tokens[0] = "alloc"
+ *    tokens[1] = "0x10"
+ *    tokens[2] = "rw"
+ *    tokens[3] = NULL
+ *
+ *  At most MAX_NR_TOKENS tokens are put into @tokens[], while @nr_tokens
+ *  counts all of them.
  *
  *
  * RETURN VALUE
@@ -45,6 +50,6 @@
  *  Return 0 otherwise
  *
  */
-int parse_command(char *command, int *nr_tokens, char *tokens[]);
+int lex_command(char *command, int *nr_tokens, char *tokens[]);
 
 #endif
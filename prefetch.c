@@ -0,0 +1,191 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdlib.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "pagetable.h"
+#include "stats.h"
+#include "swap.h"
+#include "prefetch.h"
+#include "vma.h"
+
+extern struct process *current;
+extern struct pagetable *ptbr;
+extern unsigned int *mapcounts;
+
+extern void insert_tlb(unsigned int vpn, unsigned int pfn, bool dirty);
+
+static unsigned int prefetch_window = 0;
+static bool prefetch_async = false;
+static bool prefetch_tlb = false;
+
+void init_prefetch(unsigned int window, bool async, bool fill_tlb)
+{
+	prefetch_window = window;
+	prefetch_async = async;
+	prefetch_tlb = fill_tlb;
+}
+
+/* @vpn is brought in to @pfn by prefetching */
+static void __prefetched(unsigned int vpn, unsigned int pfn)
+{
+	if (prefetch_tlb) insert_tlb(vpn, pfn, false);
+
+	/* Mapped the copy in the swap cache, which is in use already */
+	if (mapcounts[pfn] > 1) return;
+
+	mark_frame_prefetched(pfn);
+	count_event(prefetches);
+}
+
+/**
+ * __populate_page(@vpn)
+ *
+ * DESCRIPTION
+ *   Populate @vpn of the current process with a free page frame if @vpn is
+ *   allocated on demand.
+ *
+ * RETURN
+ *   @false if no page frame is free to go on
+ */
+static bool __populate_page(unsigned int vpn)
+{
+	struct vma *vma = find_vma(&current->vmas, vpn);
+	struct pte *pte;
+	unsigned int pfn;
+
+	if (!vma) return true;
+
+	pfn = get_free_frame();
+	if (pfn == NR_PAGEFRAMES) return false;
+
+	pte = populate_pte(ptbr, vpn);
+	set_pte(pte, pfn, PTE_VALID | (vma_writable(vma) ? PTE_WRITABLE : 0));
+	get_page(pfn, pte);
+	__prefetched(vpn, pfn);
+	/* All the PTEs mapping it stay at @vpn, as it is not merged */
+	page_contents[pfn].populated = true;
+	page_contents[pfn].vpn = vpn;
+	return true;
+}
+
+/**
+ * __prefetch_window(@vpn, @stride, @nr_pages, @demand, @swap)
+ *
+ * DESCRIPTION
+ *   Prefetch @nr_pages pages from @vpn at @stride, which are in the same
+ *   leaf directory. The pages to be populated on demand are brought in if
+ *   @demand is set, and the swapped-out ones are if @swap is set. They are
+ *   brought into free page frames only.
+ */
+static void __prefetch_window(unsigned int vpn, int stride,
+		unsigned int nr_pages, bool demand, bool swap)
+{
+	struct pte_directory *pd = lookup_pte_directory(ptbr, vpn, NULL);
+
+	for (unsigned int i = 0; i < nr_pages; i++, vpn += stride) {
+		struct pte *pte = pd ? &pd->ptes[pt_index(vpn, 0)] : NULL;
+
+		if (!pte || pte_none(pte)) {
+			if (!demand) continue;
+			if (!__populate_page(vpn)) break;
+
+			/* The directory may be allocated or copied for @vpn */
+			pd = lookup_pte_directory(ptbr, vpn, NULL);
+		} else if (pte_swapped(pte) && swap) {
+			if (!swap_readahead(pte)) break;
+			__prefetched(vpn, pte_pfn(pte));
+		}
+	}
+}
+
+/**
+ * Another new page is touched at @vpn. Set @stride if @vpn confirms the
+ * stride of the last touches.
+ */
+static bool __touch_page(struct prefetch_state *p, unsigned int vpn, int *stride)
+{
+	int new_stride = (int)(vpn - p->last_vpn);
+	bool confirmed = p->touched && new_stride && new_stride == p->stride;
+
+	p->stride = p->touched ? new_stride : 0;
+	p->last_vpn = vpn;
+	p->touched = true;
+
+	if (confirmed) *stride = new_stride;
+	return confirmed;
+}
+
+void prefetch_fault(unsigned int vpn)
+{
+	struct prefetch_state *p = &current->prefetch;
+	unsigned int first = vpn & ~PTE_INDEX_MASK;
+	unsigned int last = first + PTE_INDEX_MASK;
+	unsigned int nr_pages;
+	int stride = 1;
+
+	if (__touch_page(p, vpn, &stride)) {
+		/* Pages along the stride up to the end of the directory */
+		unsigned int room = stride > 0 ? (last - vpn) / stride :
+				(vpn - first) / -stride;
+
+		nr_pages = room < prefetch_window - 1 ? room : prefetch_window - 1;
+		vpn += stride;
+	} else {
+		unsigned int end;
+
+		vpn -= vpn % prefetch_window;
+		if (vpn < first) vpn = first;
+		end = vpn + prefetch_window - 1;
+		nr_pages = (end < last ? end : last) - vpn + 1;
+	}
+	if (nr_pages == 0) return;
+
+	__prefetch_window(vpn, stride, nr_pages, true, !prefetch_async);
+
+	if (prefetch_async && replacement_policy) {
+		p->pending_vpn = vpn;
+		p->pending_stride = stride;
+		p->nr_pending = nr_pages;
+	}
+}
+
+void prefetch_access(unsigned int vpn, unsigned int pfn)
+{
+	int stride;
+
+	if (!page_contents[pfn].prefetched) return;
+
+	clear_frame_prefetched(pfn);
+	count_event(prefetch_hits);
+	__touch_page(&current->prefetch, vpn, &stride);
+}
+
+void prefetch_tick(void)
+{
+	struct prefetch_state *p;
+
+	if (!current || !current->prefetch.nr_pending) return;
+
+	p = &current->prefetch;
+	__prefetch_window(p->pending_vpn, p->pending_stride, p->nr_pending,
+			false, true);
+	p->nr_pending = 0;
+}
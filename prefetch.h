@@ -0,0 +1,88 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include "types.h"
+
+/**
+ * Prefetcher on page faults. When a page not in memory is faulted in, the
+ * other pages in the window around it are brought in as well, so that the
+ * pages accessed next do not fault. The pages to be populated on demand get
+ * page frames, and the swapped-out pages are read in from the swap device.
+ * The window stays in the leaf directory of the faulting page, which is
+ * walked once for the whole window unless the pages populated on demand
+ * allocate or copy the directory.
+ *
+ * The window is the aligned run of @window pages covering the faulting page
+ * (fault-around). Once a process touches the new pages at the same stride
+ * twice in a row, the window becomes the next @window - 1 pages along the
+ * stride instead. The new pages touched are the faulting pages and the
+ * prefetched pages accessed first.
+ *
+ * In the asynchronous mode, the swapped-out pages in the window are read
+ * in the background so that the faulting access does not wait for them.
+ * They are brought in before the next access of the process.
+ *
+ * Pages are prefetched into free page frames only, and the prefetched pages
+ * not accessed yet are the first to be reclaimed when the page frames run
+ * out. So prefetching never takes the page frames from the others. The pages
+ * populated on demand hold no data until accessed, so they are dropped back
+ * to be populated on demand rather than swapped out. The prefetched pages are mapped
+ * as not accessed, and their translations are inserted into the TLB with
+ * -t. A prefetch is useful if the page frame is accessed later, and is
+ * wasted if the page frame is freed or evicted before that.
+ */
+
+/**
+ * init_prefetch(@window, @async, @fill_tlb)
+ *
+ * DESCRIPTION
+ *   Prefetch up to @window pages for each page fault, reading the swapped
+ *   out pages in the background if @async is set. @fill_tlb tells whether
+ *   the TLB is simulated.
+ */
+void init_prefetch(unsigned int window, bool async, bool fill_tlb);
+
+/**
+ * prefetch_fault(@vpn)
+ *
+ * DESCRIPTION
+ *   The current process has faulted in @vpn, which was not in memory.
+ *   Prefetch the window for the fault.
+ */
+void prefetch_fault(unsigned int vpn);
+
+/**
+ * prefetch_access(@vpn, @pfn)
+ *
+ * DESCRIPTION
+ *   Called for each access of the current process to @vpn mapped to @pfn.
+ *   The prefetch of @pfn turns out useful on the first access.
+ */
+void prefetch_access(unsigned int vpn, unsigned int pfn);
+
+/**
+ * prefetch_tick()
+ *
+ * DESCRIPTION
+ *   Called before each access. Complete the background reads of the current
+ *   process.
+ */
+void prefetch_tick(void);
+
+#endif
@@ -0,0 +1,388 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "stats.h"
+#include "profile.h"
+
+/**
+ * Map from 64-bit keys to 64-bit values in open addressing. It grows when
+ * it gets half full, and keys are never removed.
+ */
+#define EMPTY_KEY	UINT64_MAX
+
+struct profile_map {
+	uint64_t *keys;
+	uint64_t *values;
+	unsigned int bits;		/* log2 of the number of slots */
+	unsigned long nr;
+};
+
+static unsigned long __map_slot(const struct profile_map *map, uint64_t key)
+{
+	unsigned long mask = (1UL << map->bits) - 1;
+	unsigned long i = (key * 0x9e3779b97f4a7c15ULL) >> (64 - map->bits);
+
+	while (map->keys[i] != EMPTY_KEY && map->keys[i] != key) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static void __map_grow(struct profile_map *map)
+{
+	struct profile_map old = *map;
+
+	map->bits = old.keys ? old.bits + 1 : 8;
+	map->keys = malloc(sizeof(*map->keys) << map->bits);
+	map->values = malloc(sizeof(*map->values) << map->bits);
+	assert(map->keys && map->values);
+	memset(map->keys, 0xff, sizeof(*map->keys) << map->bits);
+
+	for (unsigned long i = 0; old.keys && i < (1UL << old.bits); i++) {
+		unsigned long slot;
+
+		if (old.keys[i] == EMPTY_KEY) continue;
+
+		slot = __map_slot(map, old.keys[i]);
+		map->keys[slot] = old.keys[i];
+		map->values[slot] = old.values[i];
+	}
+	free(old.keys);
+	free(old.values);
+}
+
+/**
+ * Value of @key in @map. @key is inserted if not found, and @found tells
+ * whether it was there. The value is valid until the next call.
+ */
+static uint64_t *map_get(struct profile_map *map, uint64_t key, bool *found)
+{
+	unsigned long slot;
+
+	assert(key != EMPTY_KEY);
+	if (!map->keys || map->nr * 2 >= (1UL << map->bits)) __map_grow(map);
+
+	slot = __map_slot(map, key);
+	*found = map->keys[slot] == key;
+	if (!*found) {
+		map->keys[slot] = key;
+		map->nr++;
+	}
+	return &map->values[slot];
+}
+
+
+/**
+ * LRU stack of the pages referenced on a CPU. Each reference takes the next
+ * time, and @tree marks the times of the last references to the pages. The
+ * reuse distance of a reference is the number of marks after the last
+ * reference to the page. When the times run out, the marks are renumbered
+ * in order and the tree is rebuilt, which is amortized over the references
+ * as the tree has as many free times as the pages afterward.
+ */
+#define MIN_STACK_TIMES	1024
+
+struct reuse_stack {
+	struct profile_map last;	/* (ASID, VPN) -> time of the last reference */
+	unsigned long *tree;		/* Fenwick tree of @nr_times, 1-based */
+	unsigned long nr_times;
+	unsigned long now;
+};
+
+static void __tree_add(struct reuse_stack *s, unsigned long time, long delta)
+{
+	for (unsigned long i = time + 1; i <= s->nr_times; i += i & -i) {
+		s->tree[i] += delta;
+	}
+}
+
+/* The number of marks before @time */
+static unsigned long __tree_sum(struct reuse_stack *s, unsigned long time)
+{
+	unsigned long sum = 0;
+
+	for (unsigned long i = time; i; i -= i & -i) {
+		sum += s->tree[i];
+	}
+	return sum;
+}
+
+static int __compare_times(const void *a, const void *b)
+{
+	uint64_t x = **(uint64_t * const *)a, y = **(uint64_t * const *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void __compact_stack(struct reuse_stack *s)
+{
+	unsigned long nr = s->last.nr;
+	uint64_t **times = malloc(sizeof(*times) * (nr ? nr : 1));
+	unsigned long n = 0;
+
+	for (unsigned long i = 0; s->last.keys && i < (1UL << s->last.bits); i++) {
+		if (s->last.keys[i] != EMPTY_KEY) times[n++] = &s->last.values[i];
+	}
+	qsort(times, nr, sizeof(*times), __compare_times);
+	for (unsigned long i = 0; i < nr; i++) {
+		*times[i] = i;
+	}
+	free(times);
+
+	s->nr_times = nr * 2 > MIN_STACK_TIMES ? nr * 2 : MIN_STACK_TIMES;
+	free(s->tree);
+	s->tree = calloc(s->nr_times + 1, sizeof(*s->tree));
+	assert(s->tree);
+
+	/* Build the tree with the marks at 0 .. @nr - 1 in linear time */
+	for (unsigned long i = 1; i <= s->nr_times; i++) {
+		unsigned long parent = i + (i & -i);
+
+		if (i <= nr) s->tree[i]++;
+		if (parent <= s->nr_times) s->tree[parent] += s->tree[i];
+	}
+	s->now = nr;
+}
+
+
+/**
+ * Working set of a process. @refs keeps the VPNs of the last @window
+ * references in a ring, so the page referenced @window ago leaves the
+ * working set unless it is referenced again since.
+ */
+struct working_set {
+	unsigned int pid;
+	unsigned int asid;
+	unsigned long nr_refs;		/* Virtual time of the process */
+	struct profile_map last;	/* VPN -> time of the last reference */
+	unsigned int *refs;
+	unsigned long nr_slots;		/* of @refs. Up to @window */
+	unsigned long size;
+	unsigned long size_sum;		/* over the references */
+	unsigned long peak;
+};
+
+static unsigned int window = 0;
+
+static struct reuse_stack *stacks = NULL;	/* For each CPU */
+static unsigned long *distances = NULL;		/* Histogram of reuse distances */
+static unsigned long nr_distances = 0;
+static unsigned long nr_refs = 0;
+static unsigned long nr_cold_refs = 0;
+
+static struct working_set *working_sets = NULL;
+static unsigned long nr_working_sets = 0;
+static unsigned long working_sets_size = 0;
+static struct profile_map working_set_index;	/* ASID -> @working_sets[] */
+
+void init_profile(unsigned int nr_refs_window)
+{
+	window = nr_refs_window;
+	stacks = calloc(nr_cpus, sizeof(*stacks));
+	assert(stacks);
+}
+
+static void __profile_reuse(struct reuse_stack *s, uint64_t page)
+{
+	bool found;
+	uint64_t *last;
+
+	if (s->now == s->nr_times) __compact_stack(s);
+
+	last = map_get(&s->last, page, &found);
+	nr_refs++;
+
+	if (found) {
+		unsigned long distance = __tree_sum(s, s->now) - __tree_sum(s, *last + 1);
+
+		if (distance >= nr_distances) {
+			unsigned long nr = nr_distances ? nr_distances : 64;
+
+			while (nr <= distance) nr *= 2;
+			distances = realloc(distances, sizeof(*distances) * nr);
+			assert(distances);
+			memset(distances + nr_distances, 0,
+					sizeof(*distances) * (nr - nr_distances));
+			nr_distances = nr;
+		}
+		distances[distance]++;
+		__tree_add(s, *last, -1);
+	} else {
+		nr_cold_refs++;
+	}
+
+	*last = s->now;
+	__tree_add(s, s->now++, 1);
+}
+
+static struct working_set *__get_working_set(struct process *p)
+{
+	bool found;
+	uint64_t *index = map_get(&working_set_index, p->asid, &found);
+
+	if (!found) {
+		if (nr_working_sets == working_sets_size) {
+			working_sets_size = working_sets_size ? working_sets_size * 2 : 16;
+			working_sets = realloc(working_sets,
+					sizeof(*working_sets) * working_sets_size);
+			assert(working_sets);
+		}
+		*index = nr_working_sets++;
+		working_sets[*index] = (struct working_set) {
+			.pid = p->pid,
+			.asid = p->asid,
+		};
+	}
+	return working_sets + *index;
+}
+
+static void __profile_working_set(struct working_set *ws, unsigned int vpn)
+{
+	unsigned long t = ws->nr_refs++;
+	bool found;
+	uint64_t *last;
+
+	if (t >= window) {
+		last = map_get(&ws->last, ws->refs[t % window], &found);
+		if (*last == t - window) ws->size--;
+	} else if (t == ws->nr_slots) {
+		ws->nr_slots = ws->nr_slots ? ws->nr_slots * 2 : 16;
+		if (ws->nr_slots > window) ws->nr_slots = window;
+		ws->refs = realloc(ws->refs, sizeof(*ws->refs) * ws->nr_slots);
+		assert(ws->refs);
+	}
+	ws->refs[t % window] = vpn;
+
+	last = map_get(&ws->last, vpn, &found);
+	if (!found || *last + window <= t) ws->size++;
+	*last = t;
+
+	ws->size_sum += ws->size;
+	if (ws->size > ws->peak) ws->peak = ws->size;
+}
+
+void profile_access(struct process *p, unsigned int vpn)
+{
+	__profile_reuse(stacks + this_cpu, ((uint64_t)p->asid << 32) | vpn);
+	__profile_working_set(__get_working_set(p), vpn);
+}
+
+
+/**
+ * Predicted TLB sizes. Powers of two up to the one that every reference
+ * but the cold ones hits, and the size of the simulated TLB in between.
+ */
+static unsigned long __next_tlb_size(unsigned long size)
+{
+	unsigned long next;
+
+	for (next = 1; next <= size; next *= 2);
+
+	if (size < NR_TLB_ENTRIES && NR_TLB_ENTRIES < next) return NR_TLB_ENTRIES;
+	return next;
+}
+
+static inline double __ratio(unsigned long n, unsigned long total)
+{
+	return total ? (double)n / total : 0;
+}
+
+static void __print_json(FILE *out)
+{
+	unsigned long hits = 0;
+
+	fprintf(out, "{\"window\": %u, \"working_sets\": [", window);
+	for (unsigned long i = 0; i < nr_working_sets; i++) {
+		struct working_set *ws = working_sets + i;
+
+		fprintf(out, "%s{\"pid\": %u, \"asid\": %u, \"references\": %lu, "
+				"\"pages\": %lu, \"mean_wss\": %.2f, \"peak_wss\": %lu}",
+				i ? ", " : "", ws->pid, ws->asid, ws->nr_refs, ws->last.nr,
+				__ratio(ws->size_sum, ws->nr_refs), ws->peak);
+	}
+	fprintf(out, "], \"references\": %lu, \"cold_references\": %lu, "
+			"\"reuse_distances\": {", nr_refs, nr_cold_refs);
+	for (unsigned long lo = 0, hi = 1; lo < nr_distances; lo = hi, hi *= 2) {
+		unsigned long n = 0;
+
+		for (unsigned long d = lo; d < hi; d++) n += distances[d];
+		fprintf(out, "%s\"%lu\": %lu", lo ? ", " : "", lo, n);
+	}
+	fprintf(out, "}, \"tlb_hit_rates\": {");
+	for (unsigned long size = 1, d = 0; ; size = __next_tlb_size(size)) {
+		for (; d < size && d < nr_distances; d++) hits += distances[d];
+		fprintf(out, "%s\"%lu\": %.4f", size > 1 ? ", " : "", size,
+				__ratio(hits, nr_refs));
+		if (size >= nr_distances) break;
+	}
+	fprintf(out, "}}\n");
+}
+
+void print_profile(FILE *out, enum stats_format format)
+{
+	unsigned long hits = 0;
+
+	if (format == STATS_JSON) {
+		__print_json(out);
+		return;
+	}
+
+	fprintf(out, "\n*** Working sets (window %u) ***\n", window);
+	fprintf(out, "%-6s %-6s %12s %8s %10s %10s\n", "pid", "asid",
+			"references", "pages", "mean_wss", "peak_wss");
+	for (unsigned long i = 0; i < nr_working_sets; i++) {
+		struct working_set *ws = working_sets + i;
+
+		fprintf(out, "%-6u %-6u %12lu %8lu %10.2f %10lu\n", ws->pid, ws->asid,
+				ws->nr_refs, ws->last.nr, __ratio(ws->size_sum, ws->nr_refs),
+				ws->peak);
+	}
+
+	fprintf(out, "\n*** Reuse distances ***\n");
+	fprintf(out, "%-22s %lu\n", "cold", nr_cold_refs);
+	for (unsigned long lo = 0, hi = 1; lo < nr_distances; lo = hi, hi *= 2) {
+		char range[32];
+		unsigned long n = 0;
+
+		for (unsigned long d = lo; d < hi; d++) n += distances[d];
+		if (hi - lo > 1) {
+			snprintf(range, sizeof(range), "%lu-%lu", lo, hi - 1);
+		} else {
+			snprintf(range, sizeof(range), "%lu", lo);
+		}
+		fprintf(out, "%-22s %lu\n", range, n);
+	}
+
+	fprintf(out, "\n*** Predicted TLB hit rates (fully associative, LRU) ***\n");
+	for (unsigned long size = 1, d = 0; ; size = __next_tlb_size(size)) {
+		char entries[32];
+
+		for (; d < size && d < nr_distances; d++) hits += distances[d];
+		snprintf(entries, sizeof(entries), "%lu%s", size,
+				size == NR_TLB_ENTRIES ? " (-e)" : "");
+		fprintf(out, "%-22s %.2f%%\n", entries, 100 * __ratio(hits, nr_refs));
+		if (size >= nr_distances) break;
+	}
+	fprintf(out, "\n");
+}
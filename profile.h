@@ -0,0 +1,72 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdio.h>
+
+#include "types.h"
+#include "vm.h"
+#include "stats.h"
+
+/**
+ * Working-set and reuse-distance profiler. It profiles the references of
+ * the trace in a single pass, independent of the memory geometry;
+ *
+ *   The working set of each process, which is the set of pages referenced
+ *   in the last @window references of the process (Denning's W(t, @window)).
+ *   Its mean and peak sizes are reported.
+ *
+ *   The reuse (LRU stack) distances of the references of each CPU, which
+ *   is the number of distinct pages of any address space referenced since
+ *   the last reference to the page. A fully associative LRU TLB of N
+ *   entries hits on the references of distance less than N, so the hit
+ *   rates of all TLB sizes are predicted from the histogram of distances.
+ *   The distance is found in O(log n) with a Fenwick tree over the times of
+ *   the last references to the pages.
+ *
+ * The prediction does not account for the invalidations of the TLB entries
+ * on free, copy-on-write, and swap-out.
+ */
+
+/**
+ * init_profile(@window)
+ *
+ * DESCRIPTION
+ *   Start profiling the references with the working set window of @window
+ *   references.
+ */
+void init_profile(unsigned int window);
+
+/**
+ * profile_access(@p, @vpn)
+ *
+ * DESCRIPTION
+ *   Account the reference to @vpn by @p running on @this_cpu.
+ */
+void profile_access(struct process *p, unsigned int vpn);
+
+/**
+ * print_profile(@out, @format)
+ *
+ * DESCRIPTION
+ *   Print the working sets of the processes, the histogram of the reuse
+ *   distances, and the predicted TLB hit rates.
+ */
+void print_profile(FILE *out, enum stats_format format);
+
+#endif
@@ -0,0 +1,399 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "swap.h"
+
+/**
+ * Page frames in use are chained into one of the LRU lists of the policy,
+ * from the oldest to the newest one. @referenced is set when the page frame
+ * is accessed, and is used by the policies approximating LRU. Page frames
+ * mapped by huge pages are not listed, and their references are ignored.
+ */
+struct lru_list {
+	struct list_head head;
+	unsigned long nr;
+};
+
+struct page_node {
+	struct list_head lru;
+	unsigned char list;		/* Index + 1 of the LRU list, 0 if not listed */
+	bool referenced;
+};
+
+static struct page_node *pages = NULL;
+static struct lru_list lrus[2];
+
+#define pfn_of(node)	((unsigned int)((node) - pages))
+
+static void __init_lrus(void)
+{
+	pages = calloc(NR_PAGEFRAMES, sizeof(*pages));
+
+	for (int i = 0; i < 2; i++) {
+		INIT_LIST_HEAD(&lrus[i].head);
+		lrus[i].nr = 0;
+	}
+}
+
+static void __lru_add(unsigned int pfn, int list)
+{
+	pages[pfn].list = list + 1;
+	list_add_tail(&pages[pfn].lru, &lrus[list].head);
+	lrus[list].nr++;
+}
+
+static void __lru_del(unsigned int pfn)
+{
+	struct page_node *page = pages + pfn;
+
+	if (!page->list) return;
+
+	list_del_init(&page->lru);
+	lrus[page->list - 1].nr--;
+	page->list = 0;
+	page->referenced = false;
+}
+
+static void __lru_move(unsigned int pfn, int list)
+{
+	struct page_node *page = pages + pfn;
+
+	lrus[page->list - 1].nr--;
+	list_move_tail(&page->lru, &lrus[list].head);
+	lrus[list].nr++;
+	page->list = list + 1;
+}
+
+/* The oldest page frame in @list except for @keep */
+static unsigned int __lru_oldest(int list, unsigned int keep)
+{
+	struct page_node *page;
+
+	list_for_each_entry(page, &lrus[list].head, lru) {
+		if (pfn_of(page) != keep) return pfn_of(page);
+	}
+	return NR_PAGEFRAMES;
+}
+
+static void __lru_init(unsigned int nr_slots)
+{
+	__init_lrus();
+}
+
+static void __lru_add_tail(unsigned int pfn)
+{
+	__lru_add(pfn, 0);
+}
+
+static void __set_referenced(unsigned int pfn)
+{
+	if (!pages[pfn].list) return;
+
+	pages[pfn].referenced = true;
+}
+
+
+/**
+ * FIFO: Evict the page frame that has been in use for the longest time
+ */
+static unsigned int fifo_select_victim(unsigned int keep)
+{
+	return __lru_oldest(0, keep);
+}
+
+static struct replacement_policy fifo_policy = {
+	.name = "fifo",
+	.init = __lru_init,
+	.add = __lru_add_tail,
+	.remove = __lru_del,
+	.select_victim = fifo_select_victim,
+};
+
+
+/**
+ * Clock: The head of the list is where the clock hand points to. Referenced
+ * page frames get the second chance by passing the hand with their
+ * reference cleared.
+ */
+static unsigned int clock_select_victim(unsigned int keep)
+{
+	for (unsigned long i = 0; i < lrus[0].nr * 2; i++) {
+		struct page_node *page =
+				list_first_entry(&lrus[0].head, struct page_node, lru);
+
+		if (pfn_of(page) != keep && !page->referenced) return pfn_of(page);
+
+		page->referenced = false;
+		list_move_tail(&page->lru, &lrus[0].head);
+	}
+	return NR_PAGEFRAMES;
+}
+
+/* The reference bit follows the accessed bits sampled by the scanner */
+static void clock_age(unsigned int pfn, bool referenced)
+{
+	if (!pages[pfn].list) return;
+
+	pages[pfn].referenced = referenced;
+}
+
+static struct replacement_policy clock_policy = {
+	.name = "clock",
+	.init = __lru_init,
+	.add = __lru_add_tail,
+	.remove = __lru_del,
+	.reference = __set_referenced,
+	.select_victim = clock_select_victim,
+	.age = clock_age,
+};
+
+
+/**
+ * LRU approximation with the active and inactive lists. New page frames
+ * start from the inactive list, and are promoted to the active list when
+ * they are referenced again while their reference bit is set. The active
+ * list is kept no larger than the inactive list, and victims are taken from
+ * the inactive list giving the second chance to the referenced ones.
+ */
+#define LRU_INACTIVE	0
+#define LRU_ACTIVE		1
+
+static void lru_reference(unsigned int pfn)
+{
+	struct page_node *page = pages + pfn;
+
+	if (!page->list) return;
+
+	if (page->referenced && page->list == LRU_INACTIVE + 1) {
+		__lru_move(pfn, LRU_ACTIVE);
+		page->referenced = false;
+		return;
+	}
+	page->referenced = true;
+}
+
+static unsigned int lru_select_victim(unsigned int keep)
+{
+	unsigned long nr_scan;
+
+	for (nr_scan = lrus[LRU_ACTIVE].nr;
+			nr_scan && lrus[LRU_ACTIVE].nr > lrus[LRU_INACTIVE].nr; nr_scan--) {
+		struct page_node *page =
+				list_first_entry(&lrus[LRU_ACTIVE].head, struct page_node, lru);
+
+		if (page->referenced) {
+			page->referenced = false;
+			list_move_tail(&page->lru, &lrus[LRU_ACTIVE].head);
+		} else {
+			__lru_move(pfn_of(page), LRU_INACTIVE);
+		}
+	}
+
+	for (nr_scan = lrus[LRU_INACTIVE].nr * 2; nr_scan; nr_scan--) {
+		struct page_node *page =
+				list_first_entry(&lrus[LRU_INACTIVE].head, struct page_node, lru);
+
+		if (pfn_of(page) != keep && !page->referenced) return pfn_of(page);
+
+		page->referenced = false;
+		list_move_tail(&page->lru, &lrus[LRU_INACTIVE].head);
+	}
+
+	if (__lru_oldest(LRU_INACTIVE, keep) != NR_PAGEFRAMES) {
+		return __lru_oldest(LRU_INACTIVE, keep);
+	}
+	return __lru_oldest(LRU_ACTIVE, keep);
+}
+
+/**
+ * Cold page frames on the active list are deactivated in the background,
+ * so that the victims are found without scanning the active list.
+ */
+static void lru_age(unsigned int pfn, bool referenced)
+{
+	struct page_node *page = pages + pfn;
+
+	if (referenced || page->list != LRU_ACTIVE + 1) return;
+
+	page->referenced = false;
+	__lru_move(pfn, LRU_INACTIVE);
+}
+
+static struct replacement_policy lru_policy = {
+	.name = "lru",
+	.init = __lru_init,
+	.add = __lru_add_tail,
+	.remove = __lru_del,
+	.reference = lru_reference,
+	.select_victim = lru_select_victim,
+	.age = lru_age,
+};
+
+
+/**
+ * ARC (Megiddo and Modha, FAST '03). T1 holds the page frames referenced
+ * once, and T2 holds those referenced more than once. B1 and B2 remember the
+ * swap slots of the pages evicted from T1 and T2, respectively. A swap-in
+ * from B1 (B2) tells that T1 (T2) should have been larger, and adapts
+ * @arc_target, the target size of T1, accordingly.
+ */
+#define ARC_T1	0
+#define ARC_T2	1
+
+struct ghost_node {
+	struct list_head lru;
+	unsigned char list;		/* Index + 1 of the ghost list, 0 if not listed */
+};
+
+static struct ghost_node *ghosts = NULL;
+static struct lru_list ghost_lrus[2];
+static unsigned long arc_target = 0;
+
+static void __ghost_del(unsigned int slot)
+{
+	struct ghost_node *ghost = ghosts + slot;
+
+	if (!ghost->list) return;
+
+	list_del_init(&ghost->lru);
+	ghost_lrus[ghost->list - 1].nr--;
+	ghost->list = 0;
+}
+
+static void __ghost_drop_oldest(int list)
+{
+	struct ghost_node *ghost =
+			list_first_entry(&ghost_lrus[list].head, struct ghost_node, lru);
+
+	__ghost_del(ghost - ghosts);
+}
+
+static void arc_init(unsigned int nr_slots)
+{
+	__init_lrus();
+
+	ghosts = calloc(nr_slots, sizeof(*ghosts));
+	for (int i = 0; i < 2; i++) {
+		INIT_LIST_HEAD(&ghost_lrus[i].head);
+		ghost_lrus[i].nr = 0;
+	}
+	arc_target = 0;
+}
+
+static void arc_reference(unsigned int pfn)
+{
+	if (!pages[pfn].list) return;
+
+	if (pages[pfn].list == ARC_T1 + 1) {
+		__lru_move(pfn, ARC_T2);
+	} else {
+		list_move_tail(&pages[pfn].lru, &lrus[ARC_T2].head);
+	}
+}
+
+static unsigned int arc_select_victim(unsigned int keep)
+{
+	int from = ARC_T2;
+	unsigned int pfn;
+
+	if (lrus[ARC_T1].nr && (lrus[ARC_T1].nr > arc_target || !lrus[ARC_T2].nr)) {
+		from = ARC_T1;
+	}
+
+	pfn = __lru_oldest(from, keep);
+	if (pfn == NR_PAGEFRAMES) pfn = __lru_oldest(!from, keep);
+
+	return pfn;
+}
+
+static void arc_swapped_out(unsigned int pfn, unsigned int slot)
+{
+	int list = pages[pfn].list - 1;
+	unsigned long c = NR_PAGEFRAMES;
+
+	__ghost_del(slot);
+	list_add_tail(&ghosts[slot].lru, &ghost_lrus[list].head);
+	ghosts[slot].list = list + 1;
+	ghost_lrus[list].nr++;
+
+	/* |T1| + |B1| <= c, and |T1| + |T2| + |B1| + |B2| <= 2c */
+	if (lrus[ARC_T1].nr + ghost_lrus[ARC_T1].nr > c && ghost_lrus[ARC_T1].nr) {
+		__ghost_drop_oldest(ARC_T1);
+	}
+	while (lrus[0].nr + lrus[1].nr + ghost_lrus[0].nr + ghost_lrus[1].nr > 2 * c) {
+		__ghost_drop_oldest(ghost_lrus[ARC_T2].nr ? ARC_T2 : ARC_T1);
+	}
+}
+
+static void arc_swapped_in(unsigned int pfn, unsigned int slot)
+{
+	unsigned long nr_b1 = ghost_lrus[ARC_T1].nr;
+	unsigned long nr_b2 = ghost_lrus[ARC_T2].nr;
+	unsigned long delta;
+
+	switch (ghosts[slot].list) {
+	case ARC_T1 + 1:
+		delta = nr_b2 > nr_b1 ? nr_b2 / nr_b1 : 1;
+		arc_target = arc_target + delta < NR_PAGEFRAMES ?
+				arc_target + delta : NR_PAGEFRAMES;
+		break;
+	case ARC_T2 + 1:
+		delta = nr_b1 > nr_b2 ? nr_b1 / nr_b2 : 1;
+		arc_target = arc_target > delta ? arc_target - delta : 0;
+		break;
+	default:
+		return;
+	}
+
+	__ghost_del(slot);
+	__lru_move(pfn, ARC_T2);
+}
+
+static struct replacement_policy arc_policy = {
+	.name = "arc",
+	.init = arc_init,
+	.add = __lru_add_tail,
+	.remove = __lru_del,
+	.reference = arc_reference,
+	.select_victim = arc_select_victim,
+	.swapped_out = arc_swapped_out,
+	.swapped_in = arc_swapped_in,
+	.forget = __ghost_del,
+};
+
+
+static struct replacement_policy *policies[] = {
+	&fifo_policy,
+	&clock_policy,
+	&lru_policy,
+	&arc_policy,
+	NULL,
+};
+
+struct replacement_policy *find_replacement_policy(const char *name)
+{
+	for (struct replacement_policy **p = policies; *p; p++) {
+		if (strcmp((*p)->name, name) == 0) return *p;
+	}
+	return NULL;
+}
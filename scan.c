@@ -0,0 +1,103 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdlib.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "stats.h"
+#include "swap.h"
+#include "scan.h"
+
+extern unsigned int *mapcounts;
+
+extern void flush_tlb_pfns(unsigned int *pfns, unsigned int nr);
+
+static unsigned int scan_period = 0;
+static unsigned int nr_refs_to_scan = 0;
+static unsigned int scan_cursor = 0;	/* Next page frame to scan */
+
+void init_scanner(unsigned int period)
+{
+	scan_period = period;
+	nr_refs_to_scan = period;
+	scan_cursor = 0;
+}
+
+/**
+ * __scan_frame(@pfn, @hot, @dirty)
+ *
+ * DESCRIPTION
+ *   Test and clear the accessed bits of the PTEs mapping @pfn. @hot is set
+ *   if any of them has been accessed, and @dirty is set if any of them is
+ *   dirty.
+ *
+ * RETURN
+ *   @false if @pfn is free or is mapped by a huge page, so is not scanned
+ */
+static bool __scan_frame(unsigned int pfn, bool *hot, bool *dirty)
+{
+	struct rmap_item *item;
+
+	if (!mapcounts[pfn]) return false;
+
+	for_each_rmap(item, pfn) {
+		if (pte_huge(item->pte)) return false;
+	}
+
+	*hot = *dirty = false;
+	for_each_rmap(item, pfn) {
+		*hot |= pte_accessed(item->pte);
+		*dirty |= pte_dirty(item->pte);
+		pte_clear_flags(item->pte, PTE_ACCESSED);
+	}
+	return true;
+}
+
+void scanner_tick(void)
+{
+	unsigned int hot_pfns[SCAN_BATCH];
+	unsigned int nr_hot = 0;
+
+	if (--nr_refs_to_scan) return;
+
+	nr_refs_to_scan = scan_period;
+	count_event(scan_ticks);
+
+	for (unsigned int i = 0; i < SCAN_BATCH && i < NR_PAGEFRAMES; i++) {
+		unsigned int pfn = scan_cursor;
+		bool hot, dirty;
+
+		scan_cursor = (scan_cursor + 1) % NR_PAGEFRAMES;
+		if (!__scan_frame(pfn, &hot, &dirty)) continue;
+
+		count_event(pages_scanned);
+		if (hot) {
+			count_event(pages_hot);
+			hot_pfns[nr_hot++] = pfn;
+		} else {
+			count_event(pages_cold);
+		}
+		if (dirty) count_event(pages_dirty);
+
+		age_page(pfn, hot);
+	}
+
+	/* Cached translations would access the pages without the accessed bits */
+	flush_tlb_pfns(hot_pfns, nr_hot);
+}
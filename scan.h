@@ -0,0 +1,54 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include "types.h"
+
+/**
+ * Page frame scanner, which runs in the background like kswapd. Every
+ * @period references, it goes on to the next SCAN_BATCH page frames in
+ * a circular manner, and tests and clears the accessed bits of the PTEs
+ * mapping each page frame through the reverse map. A page frame is hot if
+ * any of them has been accessed since the last scan, and is cold otherwise.
+ * The dirty bits are sampled as they are. The classification goes to the
+ * replacement policy and to the statistics.
+ *
+ * The TLB entries of the hot page frames are shot down at once for each
+ * batch, so that the next access walks the page table to set the accessed
+ * bit again. Page frames mapped by huge pages are not scanned.
+ */
+#define SCAN_BATCH	32
+
+/**
+ * init_scanner(@period)
+ *
+ * DESCRIPTION
+ *   Start the scanner to scan a batch every @period references.
+ */
+void init_scanner(unsigned int period);
+
+/**
+ * scanner_tick()
+ *
+ * DESCRIPTION
+ *   Called for each reference. Scan a batch of page frames once in @period
+ *   calls.
+ */
+void scanner_tick(void);
+
+#endif
@@ -0,0 +1,114 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "slab.h"
+
+#define SLAB_CHUNK_SIZE	(64 * 1024)
+#define SLAB_ALIGN		sizeof(void *)
+
+struct slab_chunk {
+	struct slab_chunk *next;
+	char objs[] __attribute__((aligned(16)));
+};
+
+void init_slab_cache(struct slab_cache *cache, const char *name, size_t size)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->name = name;
+	cache->size = size;
+}
+
+static void __setup_cache(struct slab_cache *cache)
+{
+	/* Freed objects hold the next pointer of the free list */
+	if (cache->size < sizeof(void *)) cache->size = sizeof(void *);
+	cache->size = (cache->size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+
+	cache->nr_per_chunk = SLAB_CHUNK_SIZE / cache->size;
+	if (cache->nr_per_chunk == 0) cache->nr_per_chunk = 1;
+}
+
+static void __grow_cache(struct slab_cache *cache)
+{
+	struct slab_chunk *chunk;
+
+	if (!cache->nr_per_chunk) __setup_cache(cache);
+
+	chunk = malloc(sizeof(*chunk) + cache->size * cache->nr_per_chunk);
+	assert(chunk);
+
+	chunk->next = cache->chunks;
+	cache->chunks = chunk;
+
+	cache->next_free = chunk->objs;
+	cache->chunk_end = chunk->objs + cache->size * cache->nr_per_chunk;
+}
+
+void *slab_alloc(struct slab_cache *cache)
+{
+	void *obj = cache->free_list;
+
+	if (obj) {
+		cache->free_list = *(void **)obj;
+	} else {
+		if (cache->next_free == cache->chunk_end) __grow_cache(cache);
+
+		obj = cache->next_free;
+		cache->next_free += cache->size;
+		cache->nr_total++;
+	}
+	cache->nr_active++;
+
+	return memset(obj, 0, cache->size);
+}
+
+void slab_free(struct slab_cache *cache, void *obj)
+{
+	if (!obj) return;
+
+	assert(cache->nr_active);
+
+	*(void **)obj = cache->free_list;
+	cache->free_list = obj;
+	cache->nr_active--;
+}
+
+size_t slab_object_size(struct slab_cache *cache)
+{
+	if (!cache->nr_per_chunk) __setup_cache(cache);
+
+	return cache->size;
+}
+
+void slab_adopt(struct slab_cache *cache, unsigned long nr_objs)
+{
+	cache->nr_active += nr_objs;
+	cache->nr_total += nr_objs;
+}
+
+void destroy_slab_cache(struct slab_cache *cache)
+{
+	while (cache->chunks) {
+		struct slab_chunk *chunk = cache->chunks;
+
+		cache->chunks = chunk->next;
+		free(chunk);
+	}
+	init_slab_cache(cache, cache->name, cache->size);
+}
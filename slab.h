@@ -0,0 +1,86 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+/**
+ * Slab cache for fixed-size objects. Objects are carved out of chunks that
+ * are allocated in bulk, and freed objects are kept in the free list of the
+ * cache to be reused by the following allocations. Chunks are never returned
+ * to the system.
+ */
+struct slab_chunk;
+
+struct slab_cache {
+	const char *name;
+	size_t size;			/* Size of each object */
+	unsigned int nr_per_chunk;
+
+	void *free_list;		/* Freed objects chained through their first word */
+	struct slab_chunk *chunks;
+	char *next_free;		/* Unused space in the latest chunk */
+	char *chunk_end;
+
+	unsigned long nr_active;	/* The number of objects in use */
+	unsigned long nr_total;		/* The number of objects carved out */
+};
+
+#define SLAB_CACHE_INIT(_name, _size) {	\
+	.name = _name,	\
+	.size = _size,	\
+}
+
+void init_slab_cache(struct slab_cache *cache, const char *name, size_t size);
+
+/**
+ * slab_alloc(@cache)
+ *
+ * RETURN
+ *   Zero-filled object of @cache->size bytes
+ */
+void *slab_alloc(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *obj);
+
+/**
+ * slab_object_size(@cache)
+ *
+ * RETURN
+ *   The number of bytes that each object of @cache takes
+ */
+size_t slab_object_size(struct slab_cache *cache);
+
+/**
+ * slab_adopt(@cache, @nr_objs)
+ *
+ * DESCRIPTION
+ *   Account @nr_objs objects placed outside the chunks of @cache, e.g., those
+ *   mapped from a checkpoint, as allocated from @cache. Each of them should
+ *   take slab_object_size() bytes, and is put into the free list when freed.
+ */
+void slab_adopt(struct slab_cache *cache, unsigned long nr_objs);
+
+/**
+ * destroy_slab_cache(@cache)
+ *
+ * DESCRIPTION
+ *   Return all the chunks of @cache to the system, and make @cache empty.
+ *   The objects of @cache should not be used any longer.
+ */
+void destroy_slab_cache(struct slab_cache *cache);
+
+#endif
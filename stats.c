@@ -0,0 +1,136 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "pagetable.h"
+#include "swap.h"
+#include "stats.h"
+#include "vma.h"
+
+struct vm_stats vm_stats = { 0 };
+
+#define STAT(name)	{ #name, offsetof(struct vm_stats, name) }
+
+static const struct {
+	const char *name;
+	size_t offset;
+} counters[] = {
+	STAT(reads),
+	STAT(writes),
+	STAT(translations),
+	STAT(tlb_hits),
+	STAT(tlb_misses),
+	STAT(huge_tlb_hits),
+	STAT(stlb_hits),
+	STAT(dirty_assists),
+	STAT(pt_walks),
+	STAT(walk_steps),
+	STAT(walk_steps_saved),
+	STAT(psc_hits),
+	STAT(psc_misses),
+	STAT(tlb_shootdowns),
+	STAT(shootdown_ipis),
+	STAT(shootdown_cycles),
+	STAT(local_accesses),
+	STAT(remote_accesses),
+	STAT(remote_cycles),
+	STAT(faults_no_directory),
+	STAT(faults_invalid_pte),
+	STAT(faults_write_protect),
+	STAT(cow_copies),
+	STAT(cow_reuses),
+	STAT(dir_unshares),
+	STAT(evictions),
+	STAT(swap_outs),
+	STAT(swap_ins),
+	STAT(major_faults),
+	STAT(minor_faults),
+	STAT(demand_faults),
+	STAT(prefetches),
+	STAT(prefetch_hits),
+	STAT(prefetch_wasted),
+	STAT(scan_ticks),
+	STAT(pages_scanned),
+	STAT(pages_hot),
+	STAT(pages_cold),
+	STAT(pages_dirty),
+	STAT(merge_passes),
+	STAT(pages_merged),
+	STAT(allocs),
+	STAT(reserves),
+	STAT(node_fallbacks),
+	STAT(huge_allocs),
+	STAT(huge_splits),
+	STAT(frees),
+	STAT(forks),
+	STAT(exits),
+	STAT(switches),
+};
+
+#define NR_COUNTERS	(sizeof(counters) / sizeof(*counters))
+
+static inline unsigned long __counter(int i)
+{
+	return *(unsigned long *)((char *)&vm_stats + counters[i].offset);
+}
+
+void print_stats(FILE *out, enum stats_format format)
+{
+	unsigned long nr_directories;
+	unsigned long pt_bytes = pagetable_memory(&nr_directories);
+	struct {
+		const char *name;
+		unsigned long value;
+	} gauges[] = {
+		{ "frames_in_use", NR_PAGEFRAMES - nr_free_frames() },
+		{ "frames_total", NR_PAGEFRAMES },
+		{ "pt_directories", nr_directories },
+		{ "pt_memory_bytes", pt_bytes },
+		{ "vmas", nr_vmas_in_use() },
+		{ "swap_slots_in_use", nr_swap_slots_used() },
+	};
+	const int nr_gauges = sizeof(gauges) / sizeof(*gauges);
+	unsigned long tlb_lookups = vm_stats.tlb_hits + vm_stats.tlb_misses;
+
+	if (format == STATS_JSON) {
+		fprintf(out, "{");
+		for (int i = 0; i < NR_COUNTERS; i++) {
+			fprintf(out, "\"%s\": %lu, ", counters[i].name, __counter(i));
+		}
+		for (int i = 0; i < nr_gauges; i++) {
+			fprintf(out, "\"%s\": %lu%s", gauges[i].name, gauges[i].value,
+					i == nr_gauges - 1 ? "}\n" : ", ");
+		}
+		return;
+	}
+
+	fprintf(out, "\n*** Statistics ***\n");
+	for (int i = 0; i < NR_COUNTERS; i++) {
+		fprintf(out, "%-22s %lu\n", counters[i].name, __counter(i));
+	}
+	for (int i = 0; i < nr_gauges; i++) {
+		fprintf(out, "%-22s %lu\n", gauges[i].name, gauges[i].value);
+	}
+	if (tlb_lookups) {
+		fprintf(out, "%-22s %.2f%%\n", "tlb_hit_rate",
+				100.0 * vm_stats.tlb_hits / tlb_lookups);
+	}
+	fprintf(out, "\n");
+}
@@ -0,0 +1,99 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+
+/**
+ * Event counters of the simulator
+ */
+struct vm_stats {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long translations;
+	unsigned long tlb_hits;
+	unsigned long tlb_misses;
+	unsigned long huge_tlb_hits;
+	unsigned long stlb_hits;
+	unsigned long dirty_assists;	/* Writes through clean TLB entries */
+	unsigned long pt_walks;
+	unsigned long walk_steps;	/* Entries read by the walks reaching the PTEs */
+	unsigned long walk_steps_saved;	/* by the paging-structure cache */
+	unsigned long psc_hits;
+	unsigned long psc_misses;
+	unsigned long tlb_shootdowns;	/* Invalidations sent to other CPUs */
+	unsigned long shootdown_ipis;
+	unsigned long shootdown_cycles;
+	unsigned long local_accesses;
+	unsigned long remote_accesses;	/* To the page frames on the other nodes */
+	unsigned long remote_cycles;
+
+	unsigned long faults_no_directory;
+	unsigned long faults_invalid_pte;
+	unsigned long faults_write_protect;
+	unsigned long cow_copies;
+	unsigned long cow_reuses;
+	unsigned long dir_unshares;
+
+	unsigned long evictions;
+	unsigned long swap_outs;
+	unsigned long swap_ins;
+	unsigned long major_faults;
+	unsigned long minor_faults;
+	unsigned long demand_faults;
+	unsigned long prefetches;
+	unsigned long prefetch_hits;	/* Prefetched pages accessed later */
+	unsigned long prefetch_wasted;	/* Freed or evicted before accessed */
+
+	unsigned long scan_ticks;
+	unsigned long pages_scanned;
+	unsigned long pages_hot;	/* Accessed since the last scan */
+	unsigned long pages_cold;
+	unsigned long pages_dirty;
+	unsigned long merge_passes;
+	unsigned long pages_merged;	/* Page frames freed by merging */
+
+	unsigned long allocs;
+	unsigned long reserves;
+	unsigned long node_fallbacks;	/* Page frames off the node of the policy */
+	unsigned long huge_allocs;
+	unsigned long huge_splits;
+	unsigned long frees;
+	unsigned long forks;
+	unsigned long exits;
+	unsigned long switches;
+};
+
+extern struct vm_stats vm_stats;
+
+#define count_event(name)	(vm_stats.name++)
+
+enum stats_format {
+	STATS_TEXT,
+	STATS_JSON,
+};
+
+/**
+ * print_stats(@out, @format)
+ *
+ * DESCRIPTION
+ *   Print the event counters along with the current usage of page frames
+ *   and page table memory.
+ */
+void print_stats(FILE *out, enum stats_format format);
+
+#endif
@@ -0,0 +1,285 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "frame.h"
+#include "pagetable.h"
+#include "stats.h"
+#include "swap.h"
+
+extern unsigned int *mapcounts;
+
+extern void flush_tlb_pfn(unsigned int pfn);
+extern void invalidate_tlb_process(struct process *p, unsigned int vpn);
+extern struct process *current;
+extern struct list_head processes;
+
+struct replacement_policy *replacement_policy = NULL;
+
+/**
+ * Swap device. A slot is in use while any swap entry refers to it. After a
+ * page is read in, the page frame remains as the cached copy of the slot so
+ * that the other swap entries of the slot map the same page frame without
+ * reading the page again. The cached copy is never written; writes to shared
+ * pages are copied on write, and exclusive pages release their slot on
+ * swap-in.
+ */
+#define NO_SLOT		(~0U)
+
+static unsigned int nr_slots;
+static unsigned int nr_slots_used;
+static struct bitmap free_slots;
+static unsigned int *swap_counts;	/* Swap entries referring to each slot */
+static unsigned int *swap_cache;	/* Page frame caching each slot */
+static unsigned int *frame_slots;	/* Slot cached by each page frame */
+static uint64_t *slot_contents;		/* Content tag of the page in each slot */
+
+void init_swap(struct replacement_policy *policy, unsigned int nr_swap_slots)
+{
+	nr_slots = nr_swap_slots;
+	init_bitmap(&free_slots, nr_slots, true);
+
+	swap_counts = calloc(nr_slots, sizeof(*swap_counts));
+	swap_cache = malloc(nr_slots * sizeof(*swap_cache));
+	slot_contents = calloc(nr_slots, sizeof(*slot_contents));
+	for (unsigned int i = 0; i < nr_slots; i++) {
+		swap_cache[i] = NR_PAGEFRAMES;
+	}
+	frame_slots = malloc(NR_PAGEFRAMES * sizeof(*frame_slots));
+	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
+		frame_slots[i] = NO_SLOT;
+	}
+
+	policy->init(nr_slots);
+	replacement_policy = policy;
+}
+
+unsigned int nr_swap_slots_used(void)
+{
+	return nr_slots_used;
+}
+
+void swap_page_added(unsigned int pfn)
+{
+	replacement_policy->add(pfn);
+}
+
+void swap_page_removed(unsigned int pfn)
+{
+	replacement_policy->remove(pfn);
+	swap_detach_frame(pfn);
+}
+
+void swap_detach_frame(unsigned int pfn)
+{
+	unsigned int slot;
+
+	if (!replacement_policy) return;
+
+	slot = frame_slots[pfn];
+	if (slot == NO_SLOT) return;
+
+	swap_cache[slot] = NR_PAGEFRAMES;
+	frame_slots[pfn] = NO_SLOT;
+}
+
+void swap_duplicate(unsigned int slot)
+{
+	assert(slot < nr_slots && swap_counts[slot]);
+
+	swap_counts[slot]++;
+}
+
+void swap_free(unsigned int slot)
+{
+	assert(slot < nr_slots && swap_counts[slot]);
+
+	if (--swap_counts[slot]) return;
+
+	if (swap_cache[slot] != NR_PAGEFRAMES) {
+		frame_slots[swap_cache[slot]] = NO_SLOT;
+		swap_cache[slot] = NR_PAGEFRAMES;
+	}
+	bitmap_set(&free_slots, slot);
+	nr_slots_used--;
+
+	if (replacement_policy->forget) replacement_policy->forget(slot);
+}
+
+/**
+ * Clear the PTE for @vpn of process @p if it maps @pfn, and reclaim the
+ * directories that become empty. The PTE of a shared leaf directory is
+ * cleared for all the page tables sharing it, but the last one is unshared
+ * first, so that no page table is left with an empty directory
+ */
+static void __drop_pte(struct process *p, unsigned int vpn, unsigned int pfn)
+{
+	bool shared;
+	struct pte_directory *pd = lookup_pte_directory(&p->pagetable, vpn, &shared);
+	struct pte *pte;
+
+	if (!pd) return;
+
+	pte = &pd->ptes[pt_index(vpn, 0)];
+	if (!pte_valid(pte) || pte_pfn(pte) != pfn) return;
+
+	if (shared && pd->nr_used == 1) {
+		pte = unshare_pte(&p->pagetable, vpn);
+		shared = false;
+	}
+	put_page(pfn, pte);
+	clear_pte(pte);
+	if (shared) {
+		pd->nr_used--;
+	} else {
+		depopulate_pte(&p->pagetable, vpn);
+	}
+	invalidate_tlb_process(p, vpn);
+}
+
+/**
+ * Turn the PTEs mapping @pfn, which the prefetcher has populated and is not
+ * accessed yet, back into the pages to be populated on demand. They are for
+ * the same VPN in the page tables, which are searched for the PTEs in the
+ * reverse map
+ */
+static void __drop_frame(unsigned int pfn)
+{
+	unsigned int vpn = page_contents[pfn].vpn;
+	struct process *p;
+
+	for (unsigned int i = 0; i < nr_cpus && mapcounts[pfn]; i++) {
+		p = i == this_cpu ? current : cpus[i].current;
+		if (p) __drop_pte(p, vpn, pfn);
+	}
+	list_for_each_entry(p, &processes, list) {
+		if (!mapcounts[pfn]) break;
+		__drop_pte(p, vpn, pfn);
+	}
+	assert(mapcounts[pfn] == 0);
+	flush_tlb_pfn(pfn);
+}
+
+bool reclaim_frame(unsigned int keep)
+{
+	unsigned int pfn, slot;
+
+	/**
+	 * The prefetched pages not accessed yet go first, so that prefetching
+	 * never takes the page frames from the others. Those populated on demand
+	 * have nothing to write out even without swapping, and are populated
+	 * again on demand
+	 */
+	pfn = find_prefetched_frame(keep);
+	if (pfn != NR_PAGEFRAMES && page_contents[pfn].populated) {
+		count_event(evictions);
+		__drop_frame(pfn);
+		return true;
+	}
+
+	if (!replacement_policy) return false;
+
+	/* Leave the page read ahead if it cannot be written out */
+	if (pfn != NR_PAGEFRAMES && frame_slots[pfn] == NO_SLOT &&
+			nr_slots_used == nr_slots) {
+		pfn = NR_PAGEFRAMES;
+	}
+	if (pfn == NR_PAGEFRAMES) pfn = replacement_policy->select_victim(keep);
+	if (pfn == NR_PAGEFRAMES) return false;
+
+	/* The page is not written out again if its slot still has the copy */
+	slot = frame_slots[pfn];
+	if (slot == NO_SLOT) {
+		slot = bitmap_find_first(&free_slots);
+		if (slot >= nr_slots) return false;
+
+		bitmap_clear(&free_slots, slot);
+		nr_slots_used++;
+		slot_contents[slot] = page_contents[pfn].tag;
+		count_event(swap_outs);
+	}
+	count_event(evictions);
+
+	if (replacement_policy->swapped_out) {
+		replacement_policy->swapped_out(pfn, slot);
+	}
+
+	/* Turn the PTEs in the reverse map into the swap entries */
+	while (rmaps[pfn]) {
+		struct pte *pte = rmaps[pfn]->pte;
+		unsigned int flags = pte_flags(pte) & PTE_WRITABLE;
+
+		set_pte(pte, slot, flags | PTE_SWAP);
+		swap_counts[slot]++;
+		put_page(pfn, pte);
+	}
+	flush_tlb_pfn(pfn);
+
+	assert(mapcounts[pfn] == 0);
+	return true;
+}
+
+static bool __swap_in(struct pte *pte, bool fault)
+{
+	unsigned int slot = pte_swap_slot(pte);
+	unsigned int flags = pte_flags(pte) & PTE_WRITABLE;
+	unsigned int pfn = swap_cache[slot];
+
+	if (pfn != NR_PAGEFRAMES) {
+		/* Other mapping has brought the page in already */
+		if (fault) count_event(minor_faults);
+		set_pte(pte, pfn, flags | PTE_VALID);
+		get_page(pfn, pte);
+	} else {
+		pfn = get_free_frame();
+		if (pfn == NR_PAGEFRAMES) {
+			/* Not worth evicting a page for the prefetcher */
+			if (!fault || !reclaim_frame(NR_PAGEFRAMES)) return false;
+			pfn = get_free_frame();
+		}
+		if (fault) count_event(major_faults);
+		count_event(swap_ins);
+
+		set_pte(pte, pfn, flags | PTE_VALID);
+		get_page(pfn, pte);
+		page_contents[pfn].tag = slot_contents[slot];
+		swap_cache[slot] = pfn;
+		frame_slots[pfn] = slot;
+
+		if (replacement_policy->swapped_in) {
+			replacement_policy->swapped_in(pfn, slot);
+		}
+	}
+
+	swap_free(slot);
+	return true;
+}
+
+bool swap_in(struct pte *pte)
+{
+	return __swap_in(pte, true);
+}
+
+bool swap_readahead(struct pte *pte)
+{
+	return __swap_in(pte, false);
+}
@@ -0,0 +1,185 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * Swap entry. When a page is swapped out, the PTE loses PTE_VALID and gets
+ * PTE_SWAP, and the PFN field holds the swap slot that keeps the contents
+ * of the page. PTE_WRITABLE is kept to restore the permission on swap-in.
+ */
+#define PTE_SWAP	0x20
+
+static inline bool pte_swapped(struct pte *pte)
+{
+	return !!(pte->val & PTE_SWAP);
+}
+
+static inline unsigned int pte_swap_slot(struct pte *pte)
+{
+	return pte->val >> PTE_PFN_SHIFT;
+}
+
+/**
+ * Page replacement policy. The policy keeps track of the page frames in use,
+ * and picks the victim to be swapped out when the system runs out of free
+ * page frames. Each policy is a set of the following callbacks. The optional
+ * ones can be NULL.
+ *
+ * @init: Set up the policy for NR_PAGEFRAMES page frames and @nr_slots swap
+ *	slots
+ * @add: Page frame @pfn becomes in use
+ * @remove: Page frame @pfn becomes free
+ * @reference: (optional) Page frame @pfn is accessed
+ * @select_victim: Pick the page frame to be swapped out except for @keep.
+ *	Return NR_PAGEFRAMES if there is nothing to evict
+ * @swapped_out: (optional) @pfn is being swapped out to @slot
+ * @swapped_in: (optional) @pfn is read in from @slot
+ * @forget: (optional) @slot is freed
+ * @age: (optional) The page frame scanner finds @pfn hot if @referenced is
+ *	set, which means @pfn has been accessed since the last scan, or cold
+ */
+struct replacement_policy {
+	const char *name;
+	void (*init)(unsigned int nr_slots);
+	void (*add)(unsigned int pfn);
+	void (*remove)(unsigned int pfn);
+	void (*reference)(unsigned int pfn);
+	unsigned int (*select_victim)(unsigned int keep);
+	void (*swapped_out)(unsigned int pfn, unsigned int slot);
+	void (*swapped_in)(unsigned int pfn, unsigned int slot);
+	void (*forget)(unsigned int slot);
+	void (*age)(unsigned int pfn, bool referenced);
+};
+
+/**
+ * Replacement policy in effect. NULL if swapping is disabled
+ */
+extern struct replacement_policy *replacement_policy;
+
+/**
+ * find_replacement_policy(@name)
+ *
+ * RETURN
+ *   The replacement policy named @name among fifo, clock, lru, and arc.
+ *   NULL if there is no such policy.
+ */
+struct replacement_policy *find_replacement_policy(const char *name);
+
+/**
+ * init_swap(@policy, @nr_slots)
+ *
+ * DESCRIPTION
+ *   Set up the swap device with @nr_slots slots, and swap out pages in
+ *   @policy when the page frames run out.
+ */
+void init_swap(struct replacement_policy *policy, unsigned int nr_slots);
+
+static inline void mark_page_referenced(unsigned int pfn)
+{
+	if (replacement_policy && replacement_policy->reference) {
+		replacement_policy->reference(pfn);
+	}
+}
+
+static inline void age_page(unsigned int pfn, bool referenced)
+{
+	if (replacement_policy && replacement_policy->age) {
+		replacement_policy->age(pfn, referenced);
+	}
+}
+
+/**
+ * Called by the frame allocator when @pfn becomes in use and free
+ */
+void swap_page_added(unsigned int pfn);
+void swap_page_removed(unsigned int pfn);
+
+/**
+ * reclaim_frame(@keep)
+ *
+ * DESCRIPTION
+ *   Swap out a page frame other than @keep to make a free page frame. The
+ *   page frame is unmapped from all the processes mapping it. The page
+ *   frames prefetched and not accessed yet are reclaimed first, and those
+ *   populated on demand are dropped without swapping out, even if swapping
+ *   is disabled.
+ *
+ * RETURN
+ *   @true if a page frame is freed
+ *   @false if no page frame can be swapped out
+ */
+bool reclaim_frame(unsigned int keep);
+
+/**
+ * swap_in(@pte)
+ *
+ * DESCRIPTION
+ *   Bring the page in the swap entry @pte into a page frame, and make @pte
+ *   map the page frame. The page is read from the swap device unless it is
+ *   still cached in a page frame after other mappings are swapped in.
+ *
+ * RETURN
+ *   @true on success
+ *   @false if no page frame is available
+ */
+bool swap_in(struct pte *pte);
+
+/**
+ * swap_readahead(@pte)
+ *
+ * DESCRIPTION
+ *   Same as swap_in(), but for the prefetcher. It is not counted as a page
+ *   fault, and no page is evicted for @pte.
+ *
+ * RETURN
+ *   @true on success
+ *   @false if no page frame is free
+ */
+bool swap_readahead(struct pte *pte);
+
+/**
+ * swap_duplicate(@slot)/swap_free(@slot)
+ *
+ * DESCRIPTION
+ *   Take and release a reference to @slot from a swap entry. @slot is freed
+ *   when no swap entry refers to it.
+ */
+void swap_duplicate(unsigned int slot);
+void swap_free(unsigned int slot);
+
+/**
+ * swap_detach_frame(@pfn)
+ *
+ * DESCRIPTION
+ *   Make @pfn no longer be the cached copy of its swap slot. Called before
+ *   writing to the page in place.
+ */
+void swap_detach_frame(unsigned int pfn);
+
+/**
+ * nr_swap_slots_used()
+ *
+ * RETURN
+ *   The number of slots in use in the swap device
+ */
+unsigned int nr_swap_slots_used(void);
+
+#endif
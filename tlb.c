@@ -0,0 +1,184 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "tlb.h"
+
+/**
+ * FIFO replaces the entry filled the earliest in the set
+ */
+static struct tlb_entry *__oldest(struct tlb_entry *set, unsigned int nr_ways)
+{
+	struct tlb_entry *victim = set;
+
+	for (unsigned int i = 1; i < nr_ways; i++) {
+		if (set[i].stamp < victim->stamp) victim = set + i;
+	}
+	return victim;
+}
+
+static struct tlb_policy fifo_policy = {
+	.name = "fifo",
+	.select_victim = __oldest,
+};
+
+
+/**
+ * LRU ranks the entries by the time they are used the last
+ */
+static void lru_fill(struct tlb_entry *set, unsigned int nr_ways, struct tlb_entry *t)
+{
+	t->rank = t->stamp;
+}
+
+static void lru_hit(struct tlb_entry *set, unsigned int nr_ways, struct tlb_entry *t)
+{
+	t->rank = ++tlb_clock;
+}
+
+static struct tlb_entry *lru_select_victim(struct tlb_entry *set, unsigned int nr_ways)
+{
+	struct tlb_entry *victim = set;
+
+	for (unsigned int i = 1; i < nr_ways; i++) {
+		if (set[i].rank < victim->rank) victim = set + i;
+	}
+	return victim;
+}
+
+static struct tlb_policy lru_policy = {
+	.name = "lru",
+	.fill = lru_fill,
+	.hit = lru_hit,
+	.select_victim = lru_select_victim,
+};
+
+
+/**
+ * Pseudo-LRU with a bit per entry, which is set when the entry is used. Once
+ * all the bits in the set are set, the bits other than the one just set are
+ * cleared, and the victim is one of the entries whose bit is clear. Unlike
+ * the tree-based one, it works for any number of ways.
+ */
+static void plru_touch(struct tlb_entry *set, unsigned int nr_ways, struct tlb_entry *t)
+{
+	t->referenced = true;
+
+	for (unsigned int i = 0; i < nr_ways; i++) {
+		if (set[i].valid && !set[i].referenced) return;
+	}
+	for (unsigned int i = 0; i < nr_ways; i++) {
+		if (set + i != t) set[i].referenced = false;
+	}
+}
+
+static struct tlb_entry *plru_select_victim(struct tlb_entry *set, unsigned int nr_ways)
+{
+	for (unsigned int i = 0; i < nr_ways; i++) {
+		if (!set[i].referenced) return set + i;
+	}
+	return set;
+}
+
+static struct tlb_policy plru_policy = {
+	.name = "plru",
+	.fill = plru_touch,
+	.hit = plru_touch,
+	.select_victim = plru_select_victim,
+};
+
+
+/**
+ * Random replacement with a fixed seed so that the runs are reproducible
+ */
+static unsigned int random_state = 1;
+
+static struct tlb_entry *random_select_victim(struct tlb_entry *set, unsigned int nr_ways)
+{
+	/* xorshift32 */
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	return set + random_state % nr_ways;
+}
+
+static struct tlb_policy random_policy = {
+	.name = "random",
+	.select_victim = random_select_victim,
+};
+
+
+/**
+ * CLOCK gives the entries used since the hand passed them the last time a
+ * second chance. The hand of a set stays next to the entry filled the last,
+ * which is the victim of the previous replacement, so that no state is
+ * kept outside the entries.
+ */
+static void clock_hit(struct tlb_entry *set, unsigned int nr_ways, struct tlb_entry *t)
+{
+	t->referenced = true;
+}
+
+static struct tlb_entry *clock_select_victim(struct tlb_entry *set, unsigned int nr_ways)
+{
+	unsigned int hand = 0;
+
+	for (unsigned int i = 1; i < nr_ways; i++) {
+		if (set[i].stamp > set[hand].stamp) hand = i;
+	}
+
+	for (unsigned int i = 1; i <= nr_ways; i++) {
+		struct tlb_entry *t = set + (hand + i) % nr_ways;
+
+		if (!t->referenced) return t;
+		t->referenced = false;
+	}
+	/* Every entry was referenced, and the one next to the hand is cleared */
+	return set + (hand + 1) % nr_ways;
+}
+
+static struct tlb_policy clock_policy = {
+	.name = "clock",
+	.hit = clock_hit,
+	.select_victim = clock_select_victim,
+};
+
+
+static struct tlb_policy *policies[] = {
+	&fifo_policy,
+	&lru_policy,
+	&plru_policy,
+	&random_policy,
+	&clock_policy,
+	NULL,
+};
+
+struct tlb_policy *tlb_policy = &fifo_policy;
+
+struct tlb_policy *find_tlb_policy(const char *name)
+{
+	for (struct tlb_policy **p = policies; *p; p++) {
+		if (strcmp((*p)->name, name) == 0) return *p;
+	}
+	return NULL;
+}
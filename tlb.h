@@ -0,0 +1,73 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __TLB_H__
+#define __TLB_H__
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * TLB replacement policy. The policy picks the entry to be replaced when
+ * every way of a TLB set is in use, and applies to each level of the TLBs
+ * and to the huge page TLB, which is a single set. The TLB fills the empty
+ * ways first by itself. An entry keeps its insertion order in @stamp, which
+ * tells the FIFO order in which the TLB is shown, and the policies keep
+ * their states of the entries in @rank and @referenced, which are reset
+ * when the entry is filled. Each policy is a set of the following callbacks
+ * on the set of @nr_ways entries from @set. The optional ones can be NULL.
+ * @fill: (optional) Entry @t is filled with a new translation
+ * @hit: (optional) Entry @t translates the address
+ * @select_victim: Pick the entry to be replaced among the valid ones
+ */
+struct tlb_policy {
+	const char *name;
+	void (*fill)(struct tlb_entry *set, unsigned int nr_ways, struct tlb_entry *t);
+	void (*hit)(struct tlb_entry *set, unsigned int nr_ways, struct tlb_entry *t);
+	struct tlb_entry *(*select_victim)(struct tlb_entry *set, unsigned int nr_ways);
+};
+
+/**
+ * TLB replacement policy in effect. FIFO unless chosen otherwise
+ */
+extern struct tlb_policy *tlb_policy;
+
+/**
+ * find_tlb_policy(@name)
+ * RETURN
+ *   The TLB replacement policy named @name among fifo, lru, plru, random,
+ *   and clock. NULL if there is no such policy.
+ */
+struct tlb_policy *find_tlb_policy(const char *name);
+
+static inline void tlb_fill(struct tlb_entry *set, unsigned int nr_ways,
+		struct tlb_entry *t)
+{
+	if (tlb_policy->fill) tlb_policy->fill(set, nr_ways, t);
+}
+
+static inline void tlb_hit(struct tlb_entry *set, unsigned int nr_ways,
+		struct tlb_entry *t)
+{
+	if (tlb_policy->hit) tlb_policy->hit(set, nr_ways, t);
+}
+
+static inline struct tlb_entry *tlb_select_victim(struct tlb_entry *set,
+		unsigned int nr_ways)
+{
+	return tlb_policy->select_victim(set, nr_ways);
+}
+#endif
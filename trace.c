@@ -0,0 +1,124 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "trace.h"
+
+static bool __valid_header(const struct trace_header *header)
+{
+	return memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 &&
+		header->version == TRACE_VERSION &&
+		header->record_size == sizeof(struct trace_record);
+}
+
+bool is_trace_file(const char *path)
+{
+	struct trace_header header;
+	FILE *file = fopen(path, "r");
+	bool ret;
+
+	if (!file) return false;
+
+	ret = fread(&header, sizeof(header), 1, file) == 1 && __valid_header(&header);
+	fclose(file);
+
+	return ret;
+}
+
+bool map_trace(struct trace_map *map, const char *path)
+{
+	const struct trace_header *header;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*header)) {
+		close(fd);
+		return false;
+	}
+
+	map->size = st.st_size;
+	map->addr = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->addr == MAP_FAILED) return false;
+
+	header = map->addr;
+	if (!__valid_header(header) ||
+			sizeof(*header) + header->nr_records * sizeof(struct trace_record)
+				> map->size) {
+		munmap(map->addr, map->size);
+		return false;
+	}
+
+	/* Records are consumed once in order */
+	madvise(map->addr, map->size, MADV_SEQUENTIAL);
+
+	map->records = (const struct trace_record *)(header + 1);
+	map->nr_records = header->nr_records;
+	return true;
+}
+
+void unmap_trace(struct trace_map *map)
+{
+	munmap(map->addr, map->size);
+}
+
+static bool __write_header(struct trace_writer *writer)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+		.nr_records = writer->nr_records,
+	};
+
+	return fseek(writer->file, 0, SEEK_SET) == 0 &&
+		fwrite(&header, sizeof(header), 1, writer->file) == 1;
+}
+
+bool create_trace(struct trace_writer *writer, const char *path)
+{
+	writer->file = fopen(path, "w");
+	writer->nr_records = 0;
+
+	if (!writer->file) return false;
+
+	/* Reserve the space for the header */
+	return __write_header(writer);
+}
+
+bool append_trace(struct trace_writer *writer, const struct trace_record *record)
+{
+	if (fwrite(record, sizeof(*record), 1, writer->file) != 1) return false;
+
+	writer->nr_records++;
+	return true;
+}
+
+bool close_trace(struct trace_writer *writer)
+{
+	bool ret = __write_header(writer);
+
+	return (fclose(writer->file) == 0) && ret;
+}
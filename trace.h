@@ -0,0 +1,114 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "types.h"
+
+/**
+ * Binary trace format. A trace file starts with struct trace_header followed
+ * by @nr_records fixed-size records. Each record corresponds to a command in
+ * the text workload, e.g., "write 0x10" becomes
+ * { .opcode = TRACE_ACCESS, .flags = RW_WRITE, .arg = 0x10 }. An operation
+ * over a VPN range is preceded by a TRACE_RANGE record, e.g., "read 0x10,4,2"
+ * becomes { .opcode = TRACE_RANGE, .arg = 4, .reserved = 2 } followed by
+ * { .opcode = TRACE_ACCESS, .flags = RW_READ, .arg = 0x10 }. The records
+ * following a TRACE_CPU record run on the CPU in its @arg.
+ */
+#define TRACE_MAGIC		"VMTRACE"
+#define TRACE_VERSION	1
+
+enum trace_opcode {
+	TRACE_NOP = 0,
+	TRACE_ACCESS,	/* Access VPN @arg for @flags */
+	TRACE_ALLOC,	/* Allocate VPN @arg for @flags */
+	TRACE_FREE,		/* Free VPN @arg */
+	TRACE_SWITCH,	/* Switch to pid @arg */
+	TRACE_SHOW,
+	TRACE_PAGES,
+	TRACE_TLB,
+	TRACE_EXIT,
+	TRACE_STATS,
+	TRACE_RANGE,	/* Next operation is for @arg VPNs with the stride in @reserved */
+	TRACE_ALLOC_HUGE,	/* Allocate the huge page covering VPN @arg for @flags */
+	TRACE_CPU,		/* Run the following records on CPU @arg */
+	TRACE_KILL,		/* Terminate pid @arg */
+	TRACE_MERGE,
+	NR_TRACE_OPCODES,
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t nr_records;
+};
+
+struct trace_record {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t reserved;
+	uint32_t arg;
+};
+
+/**
+ * is_trace_file(@path)
+ *
+ * RETURN
+ *   @true if @path starts with the binary trace header
+ */
+bool is_trace_file(const char *path);
+
+/**
+ * Binary trace file mapped into the memory
+ */
+struct trace_map {
+	void *addr;
+	size_t size;
+
+	const struct trace_record *records;
+	uint64_t nr_records;
+};
+
+/**
+ * map_trace(@map, @path)
+ *
+ * DESCRIPTION
+ *   Map the binary trace file @path into the memory.
+ *
+ * RETURN
+ *   @true on success, and @map describes the records in the trace
+ *   @false on error
+ */
+bool map_trace(struct trace_map *map, const char *path);
+void unmap_trace(struct trace_map *map);
+
+/**
+ * Writer for the binary trace. The header is finalized on close_trace().
+ */
+struct trace_writer {
+	FILE *file;
+	uint64_t nr_records;
+};
+
+bool create_trace(struct trace_writer *writer, const char *path);
+bool append_trace(struct trace_writer *writer, const struct trace_record *record);
+bool close_trace(struct trace_writer *writer);
+
+#endif
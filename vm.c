@@ -21,17 +21,100 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <strings.h>
+#include <limits.h>
 
 #include "types.h"
 #include "parser.h"
 
 #include "list_head.h"
 #include "vm.h"
+#include "frame.h"
+#include "pagetable.h"
+#include "trace.h"
+#include "stats.h"
+#include "swap.h"
+#include "checkpoint.h"
+#include "profile.h"
+#include "scan.h"
+#include "tlb.h"
+#include "ksm.h"
+#include "prefetch.h"
+#include "vma.h"
 
 static bool verbose = true;
 
 static bool print_tlb_result = false;
 
+enum output_mode output_mode = OUTPUT_UNBUFFERED;
+
+/**
+ * Buffer for stderr in OUTPUT_BUFFERED mode
+ */
+#define OUTPUT_BUFFER_SIZE	(4 << 20)
+static char *output_buffer = NULL;
+
+/**
+ * Memory geometry of the system. Can be changed with command line options
+ */
+unsigned int nr_pageframes = 128;
+unsigned int ptes_per_page_shift = 4;
+unsigned int nr_pt_levels = 2;
+unsigned int nr_tlb_entries = 256;
+unsigned int nr_tlb_ways = 8;
+unsigned int tlb_sets_shift;
+unsigned int nr_huge_tlb_entries = 8;
+unsigned int nr_stlb_entries = 0;
+unsigned int nr_stlb_ways = 8;
+unsigned int stlb_sets_shift;
+unsigned int nr_psc_entries = 0;
+unsigned int nr_cpus = 1;
+unsigned int nr_nodes = 1;
+
+/**
+ * Cycles that a TLB shootdown IPI costs for the CPUs involved
+ */
+static unsigned int ipi_cycles = 2000;
+
+/**
+ * Cycles that an access to the page frame on a remote node costs more than
+ * the one on the node of the CPU
+ */
+static unsigned int remote_access_cycles = 100;
+
+/**
+ * Pages are swapped out in the policy when page frames run out. The number
+ * of swap slots defaults to SWAP_SLOTS_PER_FRAME times the page frames
+ */
+#define SWAP_SLOTS_PER_FRAME	4
+static struct replacement_policy *policy = NULL;
+static unsigned int nr_swap_slots = 0;
+
+/**
+ * Allocated pages get page frames on their first access
+ */
+static bool demand_paging = false;
+
+/**
+ * Working set window of the profiler in references. 0 if not profiling
+ */
+static unsigned int profile_window = 0;
+
+/**
+ * References between the scans of the page frame scanner. 0 if disabled
+ */
+static unsigned int scan_period = 0;
+
+/**
+ * References between the merge passes in the background. 0 if disabled
+ */
+static unsigned int merge_period = 0;
+
+/**
+ * Pages to prefetch on each page fault. 0 if disabled
+ */
+static unsigned int prefetch_window = 0;
+static bool prefetch_async = false;
+
 /**
  * Initial process
  */
@@ -39,8 +122,9 @@ static struct process init = {
 	.pid = 0,
 	.list = LIST_HEAD_INIT(init.list),
 	.pagetable = {
-		.outer_ptes = { NULL },
+		.outer_ptes = NULL,
 	},
+	.cpumask = cpu_bit(0),
 };
 
 /**
@@ -62,22 +146,279 @@ struct pagetable *ptbr = NULL;
 /**
  * Map count for each page frame
  */
-unsigned int mapcounts[NR_PAGEFRAMES] = { 0 };
+unsigned int *mapcounts = NULL;
 
 /**
  * TLB of the system
  */
-struct tlb_entry tlb[NR_TLB_ENTRIES] = {
-	{false, 0, 0},
-};
+struct tlb_entry *tlb = NULL;
+
+/**
+ * TLB for huge pages
+ */
+struct tlb_entry *huge_tlb = NULL;
+
+/**
+ * Second-level TLB. NULL if there is no STLB
+ */
+struct tlb_entry *stlb = NULL;
+
+unsigned long tlb_clock = 0;
 
 extern unsigned int alloc_page(unsigned int vpn, unsigned int rw);
+extern unsigned int alloc_huge_page(unsigned int vpn, unsigned int rw);
 extern void free_page(unsigned int vpn);
 extern bool handle_page_fault(unsigned int vpn, unsigned int rw);
 extern void switch_process(unsigned int pid);
+extern void init_processes(void);
+extern bool exit_process(unsigned int pid);
+extern void reserve_pages(unsigned int vpn, unsigned int nr_pages,
+		unsigned int rw);
+
+extern struct tlb_entry *lookup_tlb(unsigned int vpn, unsigned int *pfn);
+extern void insert_tlb(unsigned int vpn, unsigned int pfn, bool dirty);
+extern struct tlb_entry *lookup_huge_tlb(unsigned int vpn, unsigned int *pfn);
+extern void insert_huge_tlb(unsigned int vpn, unsigned int pfn, bool dirty);
+extern struct tlb_entry *lookup_stlb(unsigned int vpn, unsigned int *pfn);
+
+/**
+ * Paging-structure cache of the running CPU
+ */
+static struct psc_entry *psc = NULL;
+unsigned long psc_clock = 0;
+
+static struct pte_directory *__lookup_psc(unsigned int vpn)
+{
+	for (int i = 0; i < nr_psc_entries; i++) {
+		struct psc_entry *e = psc + i;
+
+		if (e->valid && e->asid == current->asid &&
+				e->index == (vpn >> PTES_PER_PAGE_SHIFT)) {
+			return e->pd;
+		}
+	}
+	return NULL;
+}
+
+static void __insert_psc(unsigned int vpn, struct pte_directory *pd)
+{
+	struct psc_entry *victim = psc;
+
+	for (int i = 0; i < nr_psc_entries && victim->valid; i++) {
+		if (!psc[i].valid || psc[i].stamp < victim->stamp) victim = psc + i;
+	}
+
+	victim->valid = true;
+	victim->asid = current->asid;
+	victim->index = vpn >> PTES_PER_PAGE_SHIFT;
+	victim->pd = pd;
+	victim->stamp = ++psc_clock;
+}
+
+/**
+ * invalidate_psc(@asid, @vpn)/flush_psc_asid(@asid)
+ *
+ * DESCRIPTION
+ *   Drop the cached leaf directory for @vpn, or all cached directories of
+ *   address space @asid. Called when the TLB entries are invalidated.
+ */
+void invalidate_psc(unsigned int asid, unsigned int vpn)
+{
+	for (int i = 0; i < nr_psc_entries; i++) {
+		struct psc_entry *e = psc + i;
+
+		if (e->valid && e->asid == asid &&
+				e->index == (vpn >> PTES_PER_PAGE_SHIFT)) {
+			e->valid = false;
+		}
+	}
+}
+
+void flush_psc_asid(unsigned int asid)
+{
+	for (int i = 0; i < nr_psc_entries; i++) {
+		if (psc[i].valid && psc[i].asid == asid) psc[i].valid = false;
+	}
+}
+
+/**
+ * Simulated CPUs. The trace runs on one CPU at a time, and the state of the
+ * running CPU is loaded into @current, @ptbr, the TLBs, and @psc while
+ * those of the others are kept here. CPU 0 starts with the initial process,
+ * and the other CPUs are idle until they switch to one.
+ */
+struct cpu *cpus = NULL;
+unsigned int this_cpu = 0;
+
+void switch_cpu(unsigned int cpu)
+{
+	struct cpu *c = cpus + this_cpu;
+
+	*c = (struct cpu) {
+		.current = current,
+		.ptbr = ptbr,
+		.tlb = tlb,
+		.huge_tlb = huge_tlb,
+		.stlb = stlb,
+		.psc = psc,
+	};
+
+	c = cpus + cpu;
+	current = c->current;
+	ptbr = c->ptbr;
+	tlb = c->tlb;
+	huge_tlb = c->huge_tlb;
+	stlb = c->stlb;
+	psc = c->psc;
+	this_cpu = cpu;
+}
+
+/**
+ * smp_call_function(@mask, @func, @info)
+ *
+ * DESCRIPTION
+ *   Send TLB shootdown IPIs to the CPUs in @mask other than the running one,
+ *   and run @func with @info on each of them as they take the interrupt. The
+ *   state of the CPU taking the IPI is loaded while @func runs. Each IPI is
+ *   counted in @shootdown_ipis, costing @ipi_cycles.
+ */
+void smp_call_function(uint64_t mask, void (*func)(void *), void *info)
+{
+	unsigned int self = this_cpu;
+	unsigned int nr_ipis = 0;
+
+	mask &= ~cpu_bit(self);
+	if (!mask) return;
+
+	for (unsigned int cpu = 0; cpu < nr_cpus; cpu++) {
+		if (!(mask & cpu_bit(cpu))) continue;
+
+		switch_cpu(cpu);
+		func(info);
+		nr_ipis++;
+	}
+	switch_cpu(self);
+
+	if (!nr_ipis) return;
+
+	count_event(tlb_shootdowns);
+	vm_stats.shootdown_ipis += nr_ipis;
+	vm_stats.shootdown_cycles += (unsigned long)nr_ipis * ipi_cycles;
+}
+
+/**
+ * Leaf directory found by the last page table walk. The operations over a
+ * VPN range walk the page table once for each leaf directory, and reuse it
+ * for the following VPNs in the directory until the page table is changed.
+ */
+struct walk_cache {
+	struct pte_directory *pd;	/* NULL if nothing is cached */
+	unsigned int index;		/* VPN >> PTES_PER_PAGE_SHIFT of @pd */
+	bool shared;
+};
+
+static inline bool __walk_cached(struct walk_cache *wc, unsigned int vpn)
+{
+	return wc && wc->pd && wc->index == (vpn >> PTES_PER_PAGE_SHIFT);
+}
+
+static inline void __invalidate_walk(struct walk_cache *wc)
+{
+	if (wc) wc->pd = NULL;
+}
+
+/**
+ * __walk(@vpn, @shared, @wc)
+ *
+ * DESCRIPTION
+ *   Find the PTE for @vpn in the page table pointed by @ptbr. The leaf
+ *   directory is taken from and saved to @wc if it is not NULL.
+ *
+ * RETURN
+ *   PTE for @vpn, or NULL if the page directory does not exist
+ */
+static struct pte *__walk(unsigned int vpn, bool *shared, struct walk_cache *wc)
+{
+	struct pte_directory *pd;
+
+	if (__walk_cached(wc, vpn)) {
+		*shared = wc->shared;
+		return &wc->pd->ptes[pt_index(vpn, 0)];
+	}
+
+	count_event(pt_walks);
+
+	if (nr_psc_entries && (pd = __lookup_psc(vpn))) {
+		/* Read the PTE only, skipping the upper levels */
+		count_event(psc_hits);
+		vm_stats.walk_steps++;
+		vm_stats.walk_steps_saved += nr_pt_levels - 1;
+		*shared = false;
+	} else {
+		if (nr_psc_entries) count_event(psc_misses);
+
+		pd = lookup_pte_directory(ptbr, vpn, shared);
+		if (!pd) return NULL;
+
+		vm_stats.walk_steps += nr_pt_levels;
+		if (nr_psc_entries && !*shared) __insert_psc(vpn, pd);
+	}
+
+	if (wc) {
+		wc->pd = pd;
+		wc->index = vpn >> PTES_PER_PAGE_SHIFT;
+		wc->shared = *shared;
+	}
+	return &pd->ptes[pt_index(vpn, 0)];
+}
+
+/**
+ * __tlb_write(@t, @rw, @vpn)
+ *
+ * DESCRIPTION
+ *   The TLB entry @t is found for @vpn on @rw. If it is a write through a clean
+ *   entry, walk the page table as the MMU does to set the dirty bit of the
+ *   PTE, and the entry becomes dirty.
+ *
+ * RETURN
+ *   @true if the access goes through the TLB entry
+ *   @false if the PTE does not allow the write, which is handled as a TLB
+ *   miss so that the page fault handler takes it
+ */
+static bool __tlb_write(struct tlb_entry *t, unsigned int rw, unsigned int vpn)
+{
+	struct pte *pte;
+	bool shared = false;
+
+	if (!t) return false;
+	if (rw != RW_WRITE || t->dirty) return true;
 
-extern bool lookup_tlb(unsigned int vpn, unsigned int *pfn);
-extern void insert_tlb(unsigned int vpn, unsigned int pfn);
+	count_event(dirty_assists);
+	if (!(pte = lookup_huge_pte(ptbr, vpn))) pte = lookup_pte(ptbr, vpn, &shared);
+	if (!pte || !pte_valid(pte) || !pte_writable(pte) || shared) return false;
+
+	pte_set_flags(pte, PTE_ACCESSED | PTE_DIRTY);
+	t->dirty = true;
+	return true;
+}
+
+/**
+ * The MMU sets the accessed bit of @pte on the page table walk for @rw, and
+ * the dirty bit for write
+ */
+static void __mark_pte(struct pte *pte, unsigned int rw)
+{
+	pte_set_flags(pte, PTE_ACCESSED | (rw == RW_WRITE ? PTE_DIRTY : 0));
+}
+
+/**
+ * The TLB entry for @pte caches the dirty bit only if the PTE allows writes,
+ * since a write through a dirty entry does not check the PTE
+ */
+static inline bool __tlb_dirty(struct pte *pte, bool shared)
+{
+	return pte_dirty(pte) && pte_writable(pte) && !shared;
+}
 
 /**
  * __translate()
@@ -85,25 +426,44 @@ extern void insert_tlb(unsigned int vpn, unsigned int pfn);
  * DESCRIPTION
  *   This function simulates the address translation in MMU.
  *   It translates @vpn to @pfn using the page table pointed by @ptbr.
+ *   The page table walk may be saved with @wc for the next translation.
  *
  * RETURN
  *   @true on successful translation
  *   @false if unable to translate. This includes the case when the page access
  *   is for write (indicated in @rw), but the @writable of the pte is @false.
  */
-static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bool *from_tlb)
+static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn,
+		bool *from_tlb, struct walk_cache *wc)
 {
-	int pd_index = vpn / NR_PTES_PER_PAGE;
-	int pte_index = vpn % NR_PTES_PER_PAGE;
-
 	struct pagetable *pt = ptbr;
-	struct pte_directory *pd;
 	struct pte *pte;
+	bool shared;
+
+	count_event(translations);
 
 	/* Lookup the mapping from TLB */
-	if (print_tlb_result && lookup_tlb(vpn, pfn)) {
-		*from_tlb = true;
-		return true;
+	if (print_tlb_result) {
+		if (__tlb_write(lookup_tlb(vpn, pfn), rw, vpn)) {
+			count_event(tlb_hits);
+			mark_page_referenced(*pfn);
+			*from_tlb = true;
+			return true;
+		}
+		if (__tlb_write(lookup_huge_tlb(vpn, pfn), rw, vpn)) {
+			count_event(tlb_hits);
+			count_event(huge_tlb_hits);
+			*from_tlb = true;
+			return true;
+		}
+		if (__tlb_write(lookup_stlb(vpn, pfn), rw, vpn)) {
+			count_event(tlb_hits);
+			count_event(stlb_hits);
+			mark_page_referenced(*pfn);
+			*from_tlb = true;
+			return true;
+		}
+		count_event(tlb_misses);
 	}
 
 	/* Nah, TLB miss */
@@ -112,30 +472,77 @@ static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bo
 	/* Page table is invalid */
 	if (!pt) return false;
 
-	pd = pt->outer_ptes[pd_index];
+	/**
+	 * Huge pages are translated at the outer level. Their page frames are
+	 * not tracked by the replacement policy
+	 */
+	if ((pte = lookup_huge_pte(pt, vpn))) {
+		count_event(pt_walks);
+		count_event(walk_steps);
 
-	/* Page directory does not exist */
-	if (!pd) return false;
+		if (rw == RW_WRITE && !pte_writable(pte)) return false;
+
+		__mark_pte(pte, rw);
+		*pfn = pte_pfn(pte) + (vpn & (NR_HUGE_PAGE_PAGES - 1));
+		if (print_tlb_result) {
+			insert_huge_tlb(vpn, *pfn, __tlb_dirty(pte, false));
+		}
+		return true;
+	}
+
+	pte = __walk(vpn, &shared, wc);
 
-	pte = &pd->ptes[pte_index];
+	/* Page directory does not exist */
+	if (!pte) return false;
 
 	/* PTE is invalid */
-	if (!pte->valid) return false;
+	if (!pte_valid(pte)) return false;
 
-	/* Unable to handle the write access */
+	/**
+	 * Unable to handle the write access. Page directories shared by fork are
+	 * also write-protected
+	 */
 	if (rw == RW_WRITE) {
-		if (!pte->writable) return false;
+		if (!pte_writable(pte) || shared) return false;
 	}
-	*pfn = pte->pfn;
+	__mark_pte(pte, rw);
+	*pfn = pte_pfn(pte);
+	mark_page_referenced(*pfn);
 
 	/* Insert the mapping into TLB */
 	if (print_tlb_result) {
-		insert_tlb(vpn, *pfn);
+		insert_tlb(vpn, *pfn, __tlb_dirty(pte, shared));
 	}
 
 	return true;
 }
 
+/**
+ * The access from the running CPU to @pfn is local or remote. Counted for
+ * the accesses only, not for the translations the OS asks to probe the pages
+ */
+static inline void __count_node_access(unsigned int pfn)
+{
+	if (NR_NODES == 1 || pfn_to_node(pfn) == cpu_to_node(this_cpu)) {
+		count_event(local_accesses);
+		return;
+	}
+	count_event(remote_accesses);
+	vm_stats.remote_cycles += remote_access_cycles;
+}
+
+/**
+ * @vpn of the current process is swapped out or is not populated yet. The
+ * OS looks into the page table and the areas, which is not a walk of the MMU
+ */
+static inline bool __nonresident(unsigned int vpn)
+{
+	struct pte *pte = lookup_pte(ptbr, vpn, NULL);
+
+	if (pte && pte_swapped(pte)) return true;
+	return vma_unpopulated(&current->vmas, ptbr, vpn);
+}
+
 /**
  * __access_memory
  *
@@ -147,31 +554,46 @@ static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bo
  *   @true on successful access
  *   @false if unable to access @vpn for @rw
  */
-static bool __access_memory(unsigned int vpn, unsigned int rw)
+static bool __access_memory(unsigned int vpn, unsigned int rw,
+		struct walk_cache *wc)
 {
 	unsigned int pfn;
 	int ret;
 	int nr_retries = 0;
+	bool nonresident;
 
 	/* Cannot read and write at the same time!! */
 	assert((rw & RW_READ) ^ (rw & RW_WRITE));
 
 	/**
-	 * We have NR_PTES_PER_PAGE entries in the outer table and so do for
-	 * inner page table. Thus each process can have up to NR_PTES_PER_PAGE^2
+	 * We have NR_PTES_PER_PAGE entries in each level of the page table.
+	 * Thus each process can have up to NR_PTES_PER_PAGE^nr_pt_levels
 	 * as its VPN
 	 */
-	assert(vpn < NR_PTES_PER_PAGE * NR_PTES_PER_PAGE);
+	assert(vpn < NR_VPNS);
+
+	if (rw == RW_WRITE) {
+		count_event(writes);
+	} else {
+		count_event(reads);
+	}
+	if (profile_window) profile_access(current, vpn);
+	if (scan_period) scanner_tick();
+	if (merge_period) merger_tick();
+	if (prefetch_window) prefetch_tick();
 
 	do {
 		bool from_tlb;
 		/* Ask MMU to translate VPN */
-		if (__translate(rw, vpn, &pfn, &from_tlb)) {
+		if (__translate(rw, vpn, &pfn, &from_tlb, wc)) {
 			/* Success on address translation */
 			if (print_tlb_result) {
-				fprintf(stderr, "%c |", from_tlb ? 'o' : 'x');
+				pr_result("%c |", from_tlb ? 'o' : 'x');
 			}
-			fprintf(stderr, " %3u --> %-3u\n", vpn, pfn);
+			pr_result(" %3u --> %-3u\n", vpn, pfn);
+			__count_node_access(pfn);
+			if (rw == RW_WRITE) write_page_content(pfn, vpn);
+			if (prefetch_window) prefetch_access(vpn, pfn);
 			return true;
 		}
 
@@ -181,10 +603,17 @@ static bool __access_memory(unsigned int vpn, unsigned int rw)
 		 * Count the number of retries to prevent buggy translation.
 		 */
 		nr_retries++;
-	} while ((ret = handle_page_fault(vpn, rw)) == true && nr_retries < 2);
+
+		/* The fault handler may change the page table */
+		__invalidate_walk(wc);
+		nonresident = prefetch_window && __nonresident(vpn);
+
+		ret = handle_page_fault(vpn, rw);
+		if (ret && nonresident) prefetch_fault(vpn);
+	} while (ret == true && nr_retries < 2);
 
 	if (ret == false) {
-		fprintf(stderr, "Unable to access %u\n", vpn);
+		pr_result("Unable to access %u\n", vpn);
 	}
 
 	return ret;
@@ -206,89 +635,392 @@ static unsigned int __make_rwflag(const char *rw)
 	return rwflag;
 }
 
-static bool __alloc_page(unsigned int vpn, unsigned int rw)
+/**
+ * The PTE for @vpn of the current process if the page is swapped out. NULL
+ * otherwise
+ */
+static struct pte *__swapped_pte(unsigned int vpn, struct walk_cache *wc)
+{
+	bool shared;
+	struct pte *pte = __walk(vpn, &shared, wc);
+
+	return pte && pte_swapped(pte) ? pte : NULL;
+}
+
+static bool __alloc_page(unsigned int vpn, unsigned int rw,
+		struct walk_cache *wc)
 {
 	unsigned int pfn;
 	bool from_tlb;
+	struct pte *pte;
 
 	assert(rw);
 
-	if (__translate(RW_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is already allocated to %u\n", vpn, pfn);
+	if (__translate(RW_READ, vpn, &pfn, &from_tlb, wc)) {
+		pr_result("%u is already allocated to %u\n", vpn, pfn);
+		return false;
+	}
+	if ((pte = __swapped_pte(vpn, wc))) {
+		pr_result("%u is already allocated to swap slot %u\n", vpn,
+				pte_swap_slot(pte));
+		return false;
+	}
+	if (find_vma(&current->vmas, vpn)) {
+		pr_result("%u is already allocated on demand\n", vpn);
 		return false;
 	}
 
+	/**
+	 * Populating the PTE allocates the missing directories and unshares the
+	 * shared ones. Reclaiming a page frame for it may free the leaf of the
+	 * prefetched page dropped. The cached leaf remains intact otherwise
+	 */
+	if (!__walk_cached(wc, vpn) || wc->shared || prefetch_window) {
+		__invalidate_walk(wc);
+	}
+
+	if (demand_paging) {
+		reserve_pages(vpn, 1, rw);
+		pr_result("alloc %3u on demand\n", vpn);
+		return true;
+	}
+
 	pfn = alloc_page(vpn, rw);
 	if (pfn == -1) {
 		fprintf(stderr, "memory is full\n");
 		return false;
 	}
-	fprintf(stderr, "alloc %3u --> %-3u\n", vpn, pfn);
+	pr_result("alloc %3u --> %-3u\n", vpn, pfn);
 	
 	return true;
 }
 
-static bool __free_page(unsigned int vpn)
+/**
+ * Allocate @nr_pages pages from @vpn on demand as a single area. The pages
+ * before the first one in use are allocated at once, and then the one in
+ * use fails as in __alloc_page()
+ */
+static bool __reserve_range(unsigned int vpn, unsigned int nr_pages,
+		unsigned int rw)
+{
+	unsigned int end = vpn + nr_pages;
+	struct vma *vma = find_vma_intersection(&current->vmas, vpn, end);
+	unsigned int busy = !vma ? end : vma->start > vpn ? vma->start : vpn;
+
+	assert(rw);
+
+	if (busy > vpn) reserve_pages(vpn, busy - vpn, rw);
+
+	for (unsigned int i = vpn; i < busy && output_mode != OUTPUT_NONE; i++) {
+		pr_result("alloc %3u on demand\n", i);
+	}
+	return busy == end || __alloc_page(busy, rw, NULL);
+}
+
+static bool __alloc_huge_page(unsigned int vpn, unsigned int rw)
 {
+	unsigned int first = vpn & ~(NR_HUGE_PAGE_PAGES - 1);
 	unsigned int pfn;
-	bool from_tlb;
 
-	if (!__translate(RW_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is not allocated\n", vpn);
+	assert(rw);
+
+	if (find_vma_intersection(&current->vmas, first,
+				first + NR_HUGE_PAGE_PAGES)) {
+		pr_result("%u is already in use for huge page\n", first);
+		return false;
+	}
+
+	pfn = alloc_huge_page(first, rw);
+	if (pfn == -1) {
+		fprintf(stderr, "no %u free page frames in a row\n", NR_HUGE_PAGE_PAGES);
 		return false;
 	}
-	fprintf(stderr, "free %u (pfn %u)\n", vpn, pfn);
+	pr_result("alloc %3u --> %-3u (huge, %u pages)\n", first, pfn,
+			NR_HUGE_PAGE_PAGES);
+
+	return true;
+}
+
+/**
+ * Free @vpn while keeping @wc valid. The leaf directory is unshared, or is
+ * freed when its last PTE is freed
+ */
+static void __free_cached_page(unsigned int vpn, struct walk_cache *wc)
+{
+	if (!__walk_cached(wc, vpn) || wc->shared || wc->pd->nr_used <= 1) {
+		__invalidate_walk(wc);
+	}
 	free_page(vpn);
+}
+
+static bool __free_page(unsigned int vpn, struct walk_cache *wc)
+{
+	unsigned int pfn;
+	bool from_tlb;
+	struct pte *pte;
+
+	if ((pte = __swapped_pte(vpn, wc))) {
+		pr_result("free %u (swap slot %u)\n", vpn, pte_swap_slot(pte));
+		__free_cached_page(vpn, wc);
+		return true;
+	}
+	if (vma_unpopulated(&current->vmas, ptbr, vpn)) {
+		pr_result("free %u (not populated)\n", vpn);
+		free_page(vpn);
+		return true;
+	}
+	if (!__translate(RW_READ, vpn, &pfn, &from_tlb, wc)) {
+		pr_result("%u is not allocated\n", vpn);
+		return false;
+	}
+	pr_result("free %u (pfn %u)\n", vpn, pfn);
+	__free_cached_page(vpn, wc);
 
 	return true;
 }
 
 static void __init_system(void)
 {
+	mapcounts = calloc(NR_PAGEFRAMES, sizeof(*mapcounts));
+	/* Like the TLB, the paging-structure cache is used with -t only */
+	if (!print_tlb_result) nr_psc_entries = 0;
+
+	cpus = calloc(nr_cpus, sizeof(*cpus));
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		cpus[i].tlb = calloc(NR_TLB_ENTRIES, sizeof(*tlb));
+		cpus[i].huge_tlb = calloc(NR_HUGE_TLB_ENTRIES, sizeof(*huge_tlb));
+		if (NR_STLB_ENTRIES) cpus[i].stlb = calloc(NR_STLB_ENTRIES, sizeof(*stlb));
+		cpus[i].psc = calloc(nr_psc_entries, sizeof(*psc));
+	}
+	tlb = cpus[0].tlb;
+	huge_tlb = cpus[0].huge_tlb;
+	stlb = cpus[0].stlb;
+	psc = cpus[0].psc;
+
+	init_pagetable_caches();
+	init_pagetable(&init.pagetable);
 	ptbr = &init.pagetable;
+	init_processes();
+	init_frames();
+
+	if (policy) init_swap(policy, nr_swap_slots);
+	if (profile_window) init_profile(profile_window);
+	if (scan_period) init_scanner(scan_period);
+	if (merge_period) init_merger(merge_period);
+	if (prefetch_window) init_prefetch(prefetch_window, prefetch_async, print_tlb_result);
 }
 
-static void __show_pageframes(void)
+static void __count_mappings(struct pte_directory *pd, unsigned int *index,
+		bool shared, void *data)
 {
-	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
-		if (!mapcounts[i]) continue;
-		fprintf(stderr, "%3u: %d\n", i, mapcounts[i]);
+	unsigned int *counts = data;
+
+	for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
+		struct pte *pte = &pd->ptes[j];
+
+		if (pte_valid(pte)) counts[pte_pfn(pte)]++;
 	}
-	fprintf(stderr, "\n");
 }
 
-static void __show_pagetable(void)
+static void __count_huge_mappings(struct pagetable *pt, unsigned int *counts)
 {
-	fprintf(stderr, "\n*** PID %u ***\n", current->pid);
+	if (!pt->huge_ptes) return;
 
 	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
-		struct pte_directory *pd = current->pagetable.outer_ptes[i];
-
-		if (!pd) continue;
-
-		for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
-			struct pte *pte = &pd->ptes[j];
+		struct pte *pte = &pt->huge_ptes[i];
 
-			if (!verbose && !pte->valid) continue;
-			fprintf(stderr, "%02d:%02d %c%c | %-3d\n", i, j,
-				pte->valid ? 'v' : ' ',
-				pte->writable ? 'w' : ' ',
-				pte->pfn);
+		if (!pte_huge(pte)) continue;
+		for (int j = 0; j < NR_HUGE_PAGE_PAGES; j++) {
+			counts[pte_pfn(pte) + j]++;
 		}
-		printf("\n");
 	}
 }
 
-static void __show_tlb(void)
+static void __show_pageframes(void)
 {
-	for (int i = 0; i < sizeof(tlb) / sizeof(*tlb); i++) {
-		struct tlb_entry *t = tlb + i;
+	unsigned int *counts = calloc(NR_PAGEFRAMES, sizeof(*counts));
+	unsigned int nr_merged = 0, nr_saved = 0;
+	struct process *p;
 
-		if (!t->valid) continue;
+	/**
+	 * @mapcounts[] counts the PTEs mapping each page frame, and a PTE in the
+	 * directories shared by fork maps the page frame for all the sharers.
+	 * So count the mappings from each process, including those running on
+	 * the other CPUs
+	 */
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		p = i == this_cpu ? current : cpus[i].current;
+		if (!p) continue;
 
-		fprintf(stderr, "%3d -> %-3d\n", t->vpn, t->pfn);
+		for_each_pte_directory(&p->pagetable, __count_mappings, counts);
+		__count_huge_mappings(&p->pagetable, counts);
+	}
+	list_for_each_entry(p, &processes, list) {
+		for_each_pte_directory(&p->pagetable, __count_mappings, counts);
+		__count_huge_mappings(&p->pagetable, counts);
 	}
-}
+
+	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
+		if (!counts[i]) continue;
+		fprintf(stderr, "%3u: %d\n", i, counts[i]);
+		if (page_contents[i].merged) {
+			nr_merged++;
+			nr_saved += counts[i] - 1;
+		}
+	}
+	if (nr_merged) {
+		fprintf(stderr, "%u merged page frames save %u page frames\n",
+				nr_merged, nr_saved);
+	}
+	fprintf(stderr, "\n");
+	free(counts);
+}
+
+static void __show_pte_directory(struct pte_directory *pd, unsigned int *index,
+		bool shared, void *data)
+{
+	struct vma_tree *vmas = data;
+	unsigned int first = 0;
+
+	for (int i = 0; i < nr_pt_levels - 1; i++) {
+		first = (first << PTES_PER_PAGE_SHIFT) | index[i];
+	}
+	first <<= PTES_PER_PAGE_SHIFT;
+
+	for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
+		struct pte *pte = &pd->ptes[j];
+		struct vma *vma = pte_none(pte) ? find_vma(vmas, first + j) : NULL;
+
+		if (!verbose && pte_none(pte) && !vma) continue;
+		for (int i = 0; i < nr_pt_levels - 1; i++) {
+			fprintf(stderr, "%02d:", index[i]);
+		}
+		/**
+		 * The swap slot is shown in place of the PFN for swapped pages, and
+		 * pages to be populated on demand are marked with 'd'
+		 */
+		fprintf(stderr, "%02d %c%c | %-3d\n", j,
+			pte_valid(pte) ? 'v' : pte_swapped(pte) ? 's' : vma ? 'd' : ' ',
+			(vma ? vma_writable(vma) : pte_writable(pte)) && !shared ? 'w' : ' ',
+			pte_pfn(pte));
+	}
+	printf("\n");
+}
+
+/**
+ * Pages to be populated on demand in the directories not allocated yet are
+ * shown after the huge pages
+ */
+static void __show_unpopulated(struct vma_tree *vmas, struct pagetable *pt)
+{
+	for (struct vma *vma = first_vma(vmas); vma; vma = next_vma(vma)) {
+		for (unsigned int vpn = vma->start; vpn < vma->end; vpn++) {
+			if (lookup_huge_pte(pt, vpn) || lookup_pte(pt, vpn, NULL)) continue;
+
+			for (int i = nr_pt_levels - 1; i >= 0; i--) {
+				fprintf(stderr, "%02d%s", pt_index(vpn, i), i ? ":" : "");
+			}
+			fprintf(stderr, " d%c | %-3d\n", vma_writable(vma) ? 'w' : ' ', 0);
+		}
+	}
+}
+
+/**
+ * Huge pages are shown with 'h' after the regular pages. The indices of the
+ * lower levels are shown as '**', and the PFN is the first page frame
+ */
+static void __show_huge_ptes(struct pagetable *pt)
+{
+	if (!pt->huge_ptes) return;
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		struct pte *pte = &pt->huge_ptes[i];
+
+		if (!pte_huge(pte)) continue;
+		fprintf(stderr, "%02d:", i);
+		for (int j = 0; j < nr_pt_levels - 2; j++) {
+			fprintf(stderr, "**:");
+		}
+		fprintf(stderr, "** h%c | %-3d\n",
+			pte_writable(pte) ? 'w' : ' ', pte_pfn(pte));
+	}
+}
+
+static void __show_pagetable(void)
+{
+	fprintf(stderr, "\n*** PID %u ***\n", current->pid);
+
+	for_each_pte_directory(&current->pagetable, __show_pte_directory,
+			&current->vmas);
+	__show_huge_ptes(&current->pagetable);
+	__show_unpopulated(&current->vmas, &current->pagetable);
+}
+
+static int __compare_tlb_stamp(const void *a, const void *b)
+{
+	const struct tlb_entry *ta = *(const struct tlb_entry **)a;
+	const struct tlb_entry *tb = *(const struct tlb_entry **)b;
+
+	return (ta->stamp > tb->stamp) - (ta->stamp < tb->stamp);
+}
+
+static void __show_tlb_entries(struct tlb_entry *tlb, unsigned int nr,
+		bool huge)
+{
+	struct tlb_entry **entries = malloc(sizeof(*entries) * nr);
+	int nr_entries = 0;
+
+	/**
+	 * Entries are scattered over the sets. Print those of the current address
+	 * space in the FIFO order
+	 */
+	for (int i = 0; i < nr; i++) {
+		struct tlb_entry *t = tlb + i;
+
+		if (!t->valid || t->asid != current->asid) continue;
+		entries[nr_entries++] = t;
+	}
+	qsort(entries, nr_entries, sizeof(*entries), __compare_tlb_stamp);
+
+	for (int i = 0; i < nr_entries; i++) {
+		struct tlb_entry *t = entries[i];
+
+		if (huge) {
+			fprintf(stderr, "%3d -> %-3d (huge)\n",
+					t->vpn << HUGE_PAGE_SHIFT, t->pfn);
+		} else {
+			fprintf(stderr, "%3d -> %-3d\n", t->vpn, t->pfn);
+		}
+	}
+	free(entries);
+}
+
+/**
+ * Each level is shown in the FIFO order. The levels are headed with their
+ * hits on all CPUs when there is the STLB
+ */
+static void __show_tlb(void)
+{
+	bool levels = NR_STLB_ENTRIES;
+
+	if (levels) {
+		fprintf(stderr, "*** TLB: %lu hits ***\n", vm_stats.tlb_hits -
+				vm_stats.huge_tlb_hits - vm_stats.stlb_hits);
+	}
+	__show_tlb_entries(tlb, NR_TLB_ENTRIES, false);
+
+	if (levels) {
+		fprintf(stderr, "*** Huge page TLB: %lu hits ***\n",
+				vm_stats.huge_tlb_hits);
+	}
+	__show_tlb_entries(huge_tlb, NR_HUGE_TLB_ENTRIES, true);
+
+	if (levels) {
+		fprintf(stderr, "*** STLB: %lu hits, %lu misses ***\n",
+				vm_stats.stlb_hits, vm_stats.tlb_misses);
+		__show_tlb_entries(stlb, NR_STLB_ENTRIES, false);
+	}
+}
 
 static void __print_help(void)
 {
@@ -297,103 +1029,641 @@ static void __print_help(void)
 	printf("\n");
 	printf("  switch [pid] : Do context switch to pid @pid\n");
 	printf("                 Fork @pid if there is no process with the pid\n");
+	printf("  cpu [cpu]    : Run the following commands on CPU @cpu\n");
+	printf("  kill [pid]   : Terminate the process @pid and release its pages\n");
+	printf("  exit [pid]   : Equivalent to kill @pid\n");
 	printf("  show         : Show the page table of the current process\n");
 	printf("  pages        : Show the status for each page frame\n");
+	printf("  merge        : Merge the page frames of the same content\n");
 	printf("  tlb          : Show TLB entries\n");
+	printf("  stats        : Show the statistics of the simulation\n");
+	printf("  checkpoint [file]\n");
+	printf("               : Save the state of the simulation to @file\n");
+	printf("  restore [file]\n");
+	printf("               : Restore the state of the simulation from @file\n");
 	printf("\n");
 	printf("  alloc [vpn] r|w  : Allocate a page for the rw flag\n");
+	printf("  hugealloc [vpn] r|w : Allocate the huge page covering @vpn\n");
 	printf("  free [vpn]       : Deallocate the page at VPN @vpn\n");
 	printf("  access [vpn] r|w : Access VPN @vpn for read or write\n");
 	printf("  read [vpn]       : Equivalent to access @vpn r\n");
 	printf("  write [vpn]      : Equivalent to access @vpn w\n");
 	printf("\n");
+	printf("  [vpn] of alloc, hugealloc, free, and access can be a range of VPNs as follows\n");
+	printf("    [first]-[last]           : VPNs from @first to @last\n");
+	printf("    [start],[count]{,stride} : @count VPNs from @start by @stride\n");
+	printf("\n");
+}
+
+/**
+ * __parse_vpns(@str, @vpn, @range)
+ *
+ * DESCRIPTION
+ *   Parse @str for the VPNs of a page operation. @str is either a VPN, a
+ *   range of VPNs in "first-last", or "start,count[,stride]". @vpn is set to
+ *   the first VPN, and @range is filled in as TRACE_RANGE for the ranges.
+ *
+ * RETURN
+ *   @true if @str is valid
+ */
+static bool __parse_vpns(const char *str, unsigned int *vpn,
+		struct trace_record *range)
+{
+	char *end;
+	unsigned long first, count, stride = 1;
+
+	*range = (struct trace_record) { .opcode = TRACE_NOP };
+
+	if (!strchr(str + 1, '-') && !strchr(str, ',')) {
+		*vpn = strtoimax(str, NULL, 0);
+		return true;
+	}
+
+	first = strtoul(str, &end, 0);
+	if (*end == '-') {
+		unsigned long last = strtoul(end + 1, &end, 0);
+
+		if (last < first) return false;
+		count = last - first + 1;
+	} else {
+		count = strtoul(end + 1, &end, 0);
+		if (*end == ',') stride = strtoul(end + 1, &end, 0);
+	}
+
+	if (*end != '\0' || first > UINT_MAX || count == 0 || count > UINT_MAX ||
+			stride == 0 || stride > UINT16_MAX) {
+		return false;
+	}
+
+	*vpn = first;
+	range->opcode = TRACE_RANGE;
+	range->arg = count;
+	range->reserved = stride;
+	return true;
 }
 
-static bool strmatch(char * const str, const char *expect)
+/**
+ * Commands in text workloads. A command is looked up by its name and the
+ * number of its arguments, and @parse fills in the records for it. The
+ * checkpoint commands are run by @checkpoint instead, as the records cannot
+ * hold the file names.
+ */
+struct command {
+	const char *name;
+	int nr_args;
+	unsigned int opcode;
+	unsigned int rwflag;
+	int (*parse)(const struct command *command, char *args[],
+			struct trace_record *records);
+	bool (*checkpoint)(const char *path);
+
+	struct command *next;	/* In command_hash[] */
+};
+
+static int __parse_opcode(const struct command *command, char *args[],
+		struct trace_record *records)
 {
-	return (strlen(str) == strlen(expect)) &&
-			(strncmp(str, expect, strlen(expect)) == 0);
+	records[0] = (struct trace_record) { .opcode = command->opcode };
+	return 1;
 }
 
-static void __do_simulation(FILE *input)
+static int __parse_arg(const struct command *command, char *args[],
+		struct trace_record *records)
 {
-	char command[MAX_COMMAND_LEN] = { 0 };
+	records[0] = (struct trace_record) {
+		.opcode = command->opcode,
+		.arg = strtoimax(args[0], NULL, 0),
+	};
+	return 1;
+}
 
-	__init_system();
+/**
+ * The page operations on [vpn] and the optional [rw]. The commands without
+ * [rw] use @rwflag of the command
+ */
+static int __parse_page(const struct command *command, char *args[],
+		struct trace_record *records)
+{
+	struct trace_record range;
+	unsigned int vpn;
 
-	while (fgets(command, sizeof(command), input)) {
-		char *tokens[MAX_NR_TOKENS] = { NULL };
-		int nr_tokens = 0;
+	if (!__parse_vpns(args[0], &vpn, &range)) {
+		printf("Invalid VPN range %s\n", args[0]);
+		return 0;
+	}
 
-		/* Make the command lowercase */
-		for (size_t i = 0; i < strlen(command); i++) {
-			command[i] = tolower(command[i]);
-		}
+	records[0] = range;
+	records[range.opcode == TRACE_RANGE] = (struct trace_record) {
+		.opcode = command->opcode,
+		.flags = command->nr_args > 1 ?
+				__make_rwflag(args[1]) : command->rwflag,
+		.arg = vpn,
+	};
+	return 1 + (range.opcode == TRACE_RANGE);
+}
+
+static int __parse_help(const struct command *command, char *args[],
+		struct trace_record *records)
+{
+	__print_help();
+	return 0;
+}
+
+static struct command commands[] = {
+	{ "exit", 0, TRACE_EXIT, 0, __parse_opcode },
+	{ "show", 0, TRACE_SHOW, 0, __parse_opcode },
+	{ "pages", 0, TRACE_PAGES, 0, __parse_opcode },
+	{ "merge", 0, TRACE_MERGE, 0, __parse_opcode },
+	{ "tlb", 0, TRACE_TLB, 0, __parse_opcode },
+	{ "stats", 0, TRACE_STATS, 0, __parse_opcode },
+	{ "help", 0, TRACE_NOP, 0, __parse_help },
+	{ "?", 0, TRACE_NOP, 0, __parse_help },
+
+	{ "switch", 1, TRACE_SWITCH, 0, __parse_arg },
+	{ "s", 1, TRACE_SWITCH, 0, __parse_arg },
+	{ "cpu", 1, TRACE_CPU, 0, __parse_arg },
+	{ "kill", 1, TRACE_KILL, 0, __parse_arg },
+	{ "exit", 1, TRACE_KILL, 0, __parse_arg },
+
+	{ "free", 1, TRACE_FREE, 0, __parse_page },
+	{ "f", 1, TRACE_FREE, 0, __parse_page },
+	{ "read", 1, TRACE_ACCESS, RW_READ, __parse_page },
+	{ "r", 1, TRACE_ACCESS, RW_READ, __parse_page },
+	{ "write", 1, TRACE_ACCESS, RW_WRITE, __parse_page },
+	{ "w", 1, TRACE_ACCESS, RW_WRITE, __parse_page },
+	{ "alloc", 2, TRACE_ALLOC, 0, __parse_page },
+	{ "a", 2, TRACE_ALLOC, 0, __parse_page },
+	{ "hugealloc", 2, TRACE_ALLOC_HUGE, 0, __parse_page },
+	{ "access", 2, TRACE_ACCESS, 0, __parse_page },
+
+	{ "checkpoint", 1, .checkpoint = save_checkpoint },
+	{ "restore", 1, .checkpoint = restore_checkpoint },
+};
+#define NR_COMMANDS	(sizeof(commands) / sizeof(*commands))
+
+/**
+ * The commands are hashed by their first character, so looking up a command
+ * compares its name with a few commands at most
+ */
+#define COMMAND_HASH_SIZE	128
+static struct command *command_hash[COMMAND_HASH_SIZE];
+
+static inline unsigned int __command_hash(const char *name)
+{
+	return (unsigned char)name[0] % COMMAND_HASH_SIZE;
+}
+
+static struct command *__find_command(const char *name, int nr_args)
+{
+	static bool hashed = false;
+
+	if (!hashed) {
+		/* Keep the order of commands[] in each chain */
+		for (int i = NR_COMMANDS - 1; i >= 0; i--) {
+			struct command **head = command_hash + __command_hash(commands[i].name);
 
-		if (parse_command(command, &nr_tokens, tokens) < 0) {
-			continue;
+			commands[i].next = *head;
+			*head = commands + i;
 		}
-		if (nr_tokens == 0) continue;
-
-		if (nr_tokens == 1) {
-			if (strmatch(tokens[0], "exit")) break;
-			if (strmatch(tokens[0], "show")) {
-				__show_pagetable();
-			} else if (strmatch(tokens[0], "pages")) {
-				__show_pageframes();
-			} else if (strmatch(tokens[0], "tlb")) {
-				__show_tlb();
-			} else if (strmatch(tokens[0], "help") || strmatch(tokens[0], "?")) {
-				__print_help();
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 2) {
-			unsigned int arg = strtoimax(tokens[1], NULL, 0);
-
-			if (strmatch(tokens[0], "switch") || strmatch(tokens[0], "s")) {
-				switch_process(arg);
-			} else if (strmatch(tokens[0], "free") || strmatch(tokens[0], "f")) {
-				__free_page(arg);
-			} else if (strmatch(tokens[0], "read") || strmatch(tokens[0], "r")) {
-				__access_memory(arg, RW_READ);
-			} else if (strmatch(tokens[0], "write") || strmatch(tokens[0], "w")) {
-				__access_memory(arg, RW_WRITE);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 3) {
-			unsigned int vpn = strtoimax(tokens[1], NULL, 0);
-			unsigned int rw = __make_rwflag(tokens[2]);
-
-			if (strmatch(tokens[0], "alloc") || strmatch(tokens[0], "a")) {
-				if (!__alloc_page(vpn, rw)) break;
-			} else if (strmatch(tokens[0], "access")) {
-				__access_memory(vpn, rw);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
+		hashed = true;
+	}
+
+	for (struct command *c = command_hash[__command_hash(name)]; c; c = c->next) {
+		if (c->nr_args == nr_args && strcmp(c->name, name) == 0) return c;
+	}
+	return NULL;
+}
+
+/**
+ * __parse_record(@command, @records, @run)
+ *
+ * DESCRIPTION
+ *   Parse the text @command into @records. Commands not for the simulation,
+ *   like help, are handled here. The checkpoint commands are run only if
+ *   @run is set. @records should have room for MAX_RECORDS_PER_COMMAND
+ *   records.
+ *
+ * RETURN
+ *   The number of records filled in @records
+ *   0 if there is nothing to simulate for @command
+ *   -1 if @command is empty
+ */
+#define MAX_RECORDS_PER_COMMAND	2
+
+static int __parse_record(char *command, struct trace_record *records, bool run)
+{
+	char *tokens[MAX_NR_TOKENS] = { NULL };
+	int nr_tokens = 0;
+	struct command *c;
+
+	if (!lex_command(command, &nr_tokens, tokens)) return -1;
+
+	c = __find_command(tokens[0], nr_tokens - 1);
+	if (!c) {
+		printf("Unknown command %s\n", tokens[0]);
+		return 0;
+	}
+
+	if (c->checkpoint) {
+		if (run) {
+			c->checkpoint(tokens[1]);
 		} else {
-			assert(!"Unknown command in trace");
+			fprintf(stderr, "Checkpoints are not recorded in binary traces\n");
+		}
+		return 0;
+	}
+	return c->parse(c, tokens + 1, records);
+}
+
+/**
+ * __do_range(@record, @range)
+ *
+ * DESCRIPTION
+ *   Do the page operation in @record for each VPN in @range. The page
+ *   table is walked once for each leaf directory in the range.
+ *
+ * RETURN
+ *   @false if the simulation should be stopped
+ *   @true otherwise
+ */
+static bool __do_range(const struct trace_record *record,
+		const struct trace_record *range)
+{
+	struct walk_cache wc = { .pd = NULL };
+	uint64_t last = record->arg + (uint64_t)(range->arg - 1) * range->reserved;
+
+	if (last >= NR_VPNS) {
+		pr_result("Invalid VPN range %u,%u,%u\n", record->arg, range->arg,
+				range->reserved);
+		return true;
+	}
+
+	/* Pages in a row are allocated on demand by the area at once */
+	if (record->opcode == TRACE_ALLOC && demand_paging && range->reserved == 1) {
+		return __reserve_range(record->arg, range->arg, record->flags);
+	}
+
+	for (uint64_t vpn = record->arg; vpn <= last; vpn += range->reserved) {
+		switch (record->opcode) {
+		case TRACE_ACCESS:
+			__access_memory(vpn, record->flags, &wc);
+			break;
+		case TRACE_ALLOC:
+			if (!__alloc_page(vpn, record->flags, &wc)) return false;
+			break;
+		case TRACE_ALLOC_HUGE:
+			if (!__alloc_huge_page(vpn, record->flags)) return false;
+			break;
+		case TRACE_FREE:
+			__free_page(vpn, &wc);
+			break;
 		}
+	}
+	return true;
+}
+
+/**
+ * Commands that run in the address space of the current process. They are
+ * ignored on idle CPUs
+ */
+static inline bool __needs_process(unsigned int opcode)
+{
+	return opcode == TRACE_ACCESS || opcode == TRACE_ALLOC ||
+			opcode == TRACE_ALLOC_HUGE || opcode == TRACE_FREE ||
+			opcode == TRACE_SHOW || opcode == TRACE_TLB;
+}
+
+/**
+ * __do_record(@record)
+ *
+ * RETURN
+ *   @false if the simulation should be stopped
+ *   @true otherwise
+ */
+static bool __do_record(const struct trace_record *record)
+{
+	/* TRACE_RANGE applies to the following record */
+	static struct trace_record range = { .opcode = TRACE_NOP };
+
+	if (!current && __needs_process(record->opcode)) {
+		range.opcode = TRACE_NOP;
+		pr_result("CPU %u is idle\n", this_cpu);
+		return true;
+	}
+
+	if (range.opcode == TRACE_RANGE) {
+		range.opcode = TRACE_NOP;
+
+		if (record->opcode == TRACE_ACCESS || record->opcode == TRACE_ALLOC ||
+				record->opcode == TRACE_ALLOC_HUGE ||
+				record->opcode == TRACE_FREE) {
+			return __do_range(record, &range);
+		}
+	}
+
+	switch (record->opcode) {
+	case TRACE_RANGE:
+		range = *record;
+		break;
+	case TRACE_ACCESS:
+		__access_memory(record->arg, record->flags, NULL);
+		break;
+	case TRACE_ALLOC:
+		return __alloc_page(record->arg, record->flags, NULL);
+	case TRACE_ALLOC_HUGE:
+		return __alloc_huge_page(record->arg, record->flags);
+	case TRACE_FREE:
+		__free_page(record->arg, NULL);
+		break;
+	case TRACE_SWITCH:
+		switch_process(record->arg);
+		break;
+	case TRACE_CPU:
+		if (record->arg >= nr_cpus) {
+			pr_result("No CPU %u\n", record->arg);
+			break;
+		}
+		switch_cpu(record->arg);
+		break;
+	case TRACE_KILL:
+		if (!exit_process(record->arg)) pr_result("No process %u\n", record->arg);
+		break;
+	case TRACE_SHOW:
+		__show_pagetable();
+		break;
+	case TRACE_PAGES:
+		__show_pageframes();
+		break;
+	case TRACE_MERGE:
+		pr_result("merge %u page frames\n", merge_pages());
+		break;
+	case TRACE_TLB:
+		__show_tlb();
+		break;
+	case TRACE_STATS:
+		print_stats(stdout, STATS_TEXT);
+		break;
+	case TRACE_EXIT:
+		return false;
+	default:
+		break;
+	}
+	return true;
+}
+
+static void __do_simulation(FILE *input)
+{
+	char command[MAX_COMMAND_LEN] = { 0 };
+
+	while (fgets(command, sizeof(command), input)) {
+		struct trace_record records[MAX_RECORDS_PER_COMMAND];
+		int ret;
+		bool stop = false;
+
+		ret = __parse_record(command, records, true);
+		if (ret < 0) continue;
+		for (int i = 0; i < ret && !stop; i++) {
+			stop = !__do_record(records + i);
+		}
+		if (stop) break;
 
 		if (verbose) printf(">> ");
 	}
 }
 
+/**
+ * __replay_trace(@map)
+ *
+ * DESCRIPTION
+ *   Run the simulation with the records in the binary trace @map
+ */
+static void __replay_trace(struct trace_map *map)
+{
+	for (uint64_t i = 0; i < map->nr_records; i++) {
+		if (!__do_record(map->records + i)) break;
+	}
+}
+
+/**
+ * __convert_trace(@input, @path)
+ *
+ * DESCRIPTION
+ *   Convert the text workload from @input into the binary trace at @path
+ *   without running the simulation.
+ */
+static bool __convert_trace(FILE *input, const char *path)
+{
+	char command[MAX_COMMAND_LEN] = { 0 };
+	struct trace_writer writer;
+
+	if (!create_trace(&writer, path)) {
+		fprintf(stderr, "Unable to create trace %s\n", path);
+		return false;
+	}
+
+	while (fgets(command, sizeof(command), input)) {
+		struct trace_record records[MAX_RECORDS_PER_COMMAND];
+		int ret;
+
+		ret = __parse_record(command, records, false);
+		for (int i = 0; i < ret; i++) {
+			if (!append_trace(&writer, records + i)) {
+				fprintf(stderr, "Unable to write trace %s\n", path);
+				close_trace(&writer);
+				return false;
+			}
+		}
+	}
+
+	if (!close_trace(&writer)) {
+		fprintf(stderr, "Unable to write trace %s\n", path);
+		return false;
+	}
+	return true;
+}
+
 static void __print_usage(const char * name)
 {
-	printf("Usage: %s {-q} {-f [workload file]}\n", name);
+	printf("Usage: %s {-q} {-t} {-p frames} {-s shift} {-l levels} {-e entries} {-w ways} {-H entries} {-E entries} {-A ways} {-T policy} {-P entries} {-C cpus} {-I cycles} {-N nodes} {-m policy} {-L cycles} {-R checkpoint} {-c trace} {-o mode} {-S format} {-r policy} {-x slots} {-d} {-W window} {-k period} {-M period} {-F window} {-B} {workload file}\n", name);
 	printf("\n");
-	printf("  -q: Run quietly\n\n");
+	printf("  -q: Run quietly\n");
+	printf("  -t: Translate through TLB and print the TLB result\n");
+	printf("  -p: Number of page frames (default: %u)\n", nr_pageframes);
+	printf("  -s: Page table has 2^shift entries in each level (default: %u)\n", ptes_per_page_shift);
+	printf("  -l: Number of page table levels (default: %u)\n", nr_pt_levels);
+	printf("  -e: Number of TLB entries (default: %u)\n", nr_tlb_entries);
+	printf("  -w: Number of ways in each TLB set (default: %u)\n", nr_tlb_ways);
+	printf("  -H: Number of huge page TLB entries (default: %u)\n", nr_huge_tlb_entries);
+	printf("  -E: Number of second-level TLB entries (default: %u, no STLB)\n", nr_stlb_entries);
+	printf("  -A: Number of ways in each second-level TLB set (default: %u)\n", nr_stlb_ways);
+	printf("  -T: Replace the TLB entries in the policy\n");
+	printf("      fifo (default), lru, plru, random, or clock\n");
+	printf("  -P: Number of paging-structure cache entries with -t (default: %u)\n", nr_psc_entries);
+	printf("  -C: Number of CPUs (default: %u)\n", nr_cpus);
+	printf("  -I: Cycles to send a TLB shootdown IPI (default: %u)\n", ipi_cycles);
+	printf("  -N: Number of memory nodes (default: %u)\n", nr_nodes);
+	printf("  -m: Allocate page frames from the nodes in the policy\n");
+	printf("      local (default), interleave, or preferred\n");
+	printf("  -L: Cycles that an access to a remote node costs more (default: %u)\n",
+			remote_access_cycles);
+	printf("  -R: Start from the checkpoint in its geometry, without -r\n");
+	printf("  -c: Convert the workload into the binary trace file, and exit\n");
+	printf("  -o: Output mode for the results of memory operations\n");
+	printf("      unbuffered (default), buffered, or none\n");
+	printf("  -S: Print the statistics in text or json format at the end\n");
+	printf("  -r: Swap out pages in the policy when page frames run out\n");
+	printf("      fifo, clock, lru, or arc (default: disabled)\n");
+	printf("  -x: Number of swap slots (default: %d times the page frames)\n",
+			SWAP_SLOTS_PER_FRAME);
+	printf("  -d: Allocate page frames on the first access to the pages\n");
+	printf("  -W: Profile the working sets in the window of references, and\n");
+	printf("      the reuse distances to predict the TLB hit rates at the end\n");
+	printf("  -k: Scan the accessed bits of %d page frames every given references\n",
+			SCAN_BATCH);
+	printf("  -M: Merge the page frames of the same content every given references\n");
+	printf("  -F: Prefetch the window of pages around each page fault, or along\n");
+	printf("      the stride of the faults\n");
+	printf("  -B: Read the swapped-out pages to prefetch in the background with -F\n\n");
+}
+
+static bool __parse_output_mode(const char *mode)
+{
+	if (strcmp(mode, "unbuffered") == 0) {
+		output_mode = OUTPUT_UNBUFFERED;
+	} else if (strcmp(mode, "buffered") == 0) {
+		output_mode = OUTPUT_BUFFERED;
+	} else if (strcmp(mode, "none") == 0) {
+		output_mode = OUTPUT_NONE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool __parse_numa_policy(const char *name)
+{
+	if (strcmp(name, "local") == 0) {
+		numa_policy = NUMA_LOCAL;
+	} else if (strcmp(name, "interleave") == 0) {
+		numa_policy = NUMA_INTERLEAVE;
+	} else if (strcmp(name, "preferred") == 0) {
+		numa_policy = NUMA_PREFERRED;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool __parse_number(const char *str, unsigned int *value)
+{
+	char *end;
+	unsigned long v = strtoul(str, &end, 0);
+
+	if (*str == '\0' || *end != '\0' || v > UINT_MAX) return false;
+
+	*value = v;
+	return true;
+}
+
+/**
+ * __setup_tlb_sets(@name, @nr_entries, @nr_ways, @sets_shift)
+ *
+ * DESCRIPTION
+ *   Derive @sets_shift of the TLB called @name, which has @nr_entries
+ *   entries in the sets of @nr_ways ways.
+ */
+static bool __setup_tlb_sets(const char *name, unsigned int nr_entries,
+		unsigned int nr_ways, unsigned int *sets_shift)
+{
+	unsigned int nr_sets;
+
+	if (nr_ways == 0 || nr_entries % nr_ways) {
+		fprintf(stderr, "%s entries should be a multiple of the ways\n", name);
+		return false;
+	}
+
+	nr_sets = nr_entries / nr_ways;
+	if (nr_sets & (nr_sets - 1)) {
+		fprintf(stderr, "The number of %s sets should be a power of two\n", name);
+		return false;
+	}
+	for (*sets_shift = 0; (1U << *sets_shift) < nr_sets; (*sets_shift)++);
+	return true;
+}
+
+/**
+ * __setup_geometry()
+ *
+ * DESCRIPTION
+ *   Validate the memory geometry given by the command line options, and
+ *   derive the parameters for the address translation. The number of TLB
+ *   sets should be a power of two so that the set index is taken from the
+ *   lower VPN bits.
+ *
+ * RETURN
+ *   @true if the geometry is valid
+ *   @false otherwise
+ */
+static bool __setup_geometry(void)
+{
+	if (nr_pageframes == 0 || nr_pageframes > MAX_PAGEFRAMES) {
+		fprintf(stderr, "The number of page frames should be 1 to %u\n",
+				MAX_PAGEFRAMES);
+		return false;
+	}
+	if (nr_pt_levels < 2 || nr_pt_levels > MAX_PT_LEVELS) {
+		fprintf(stderr, "Page table should have 2 to %d levels\n", MAX_PT_LEVELS);
+		return false;
+	}
+	if (ptes_per_page_shift == 0 || ptes_per_page_shift * nr_pt_levels > 32) {
+		fprintf(stderr, "VPN should be between %u and 32 bits\n", nr_pt_levels);
+		return false;
+	}
+	if (nr_cpus == 0 || nr_cpus > MAX_CPUS) {
+		fprintf(stderr, "The number of CPUs should be 1 to %d\n", MAX_CPUS);
+		return false;
+	}
+	if (nr_nodes == 0 || nr_nodes > MAX_NODES) {
+		fprintf(stderr, "The number of memory nodes should be 1 to %d\n", MAX_NODES);
+		return false;
+	}
+	if (nr_nodes > nr_pageframes) {
+		fprintf(stderr, "Each memory node should have a page frame at least\n");
+		return false;
+	}
+	if (!__setup_tlb_sets("TLB", nr_tlb_entries, nr_tlb_ways, &tlb_sets_shift)) {
+		return false;
+	}
+	if (nr_stlb_entries && !__setup_tlb_sets("STLB", nr_stlb_entries,
+				nr_stlb_ways, &stlb_sets_shift)) {
+		return false;
+	}
+
+	if (policy && !nr_swap_slots) {
+		nr_swap_slots = nr_pageframes > MAX_PAGEFRAMES / SWAP_SLOTS_PER_FRAME ?
+				MAX_PAGEFRAMES : nr_pageframes * SWAP_SLOTS_PER_FRAME;
+	}
+	if (nr_swap_slots > MAX_PAGEFRAMES) {
+		fprintf(stderr, "The number of swap slots should be up to %u\n",
+				MAX_PAGEFRAMES);
+		return false;
+	}
+
+	return true;
 }
 
 int main(int argc, char * argv[])
 {
 	int opt;
 	FILE *input = stdin;
+	struct trace_map trace = { .addr = NULL };
+	char *convert_to = NULL;
+	char *summary = NULL;
+	char *restore_from = NULL;
+
+	while ((opt = getopt(argc, argv, "qhtp:s:l:e:w:H:E:A:T:P:C:I:N:m:L:R:c:o:S:r:x:dW:k:M:F:B")) != -1) {
+		unsigned int *param = NULL;
 
-	while ((opt = getopt(argc, argv, "qht")) != -1) {
 		switch (opt) {
 		case 'q':
 			verbose = false;
@@ -401,11 +1671,122 @@ int main(int argc, char * argv[])
 		case 't':
 			print_tlb_result = true;
 			break;
+		case 'p':
+			param = &nr_pageframes;
+			break;
+		case 's':
+			param = &ptes_per_page_shift;
+			break;
+		case 'l':
+			param = &nr_pt_levels;
+			break;
+		case 'e':
+			param = &nr_tlb_entries;
+			break;
+		case 'w':
+			param = &nr_tlb_ways;
+			break;
+		case 'H':
+			param = &nr_huge_tlb_entries;
+			break;
+		case 'E':
+			param = &nr_stlb_entries;
+			break;
+		case 'A':
+			param = &nr_stlb_ways;
+			break;
+		case 'T':
+			if (!(tlb_policy = find_tlb_policy(optarg))) {
+				fprintf(stderr, "Unknown TLB replacement policy %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'P':
+			param = &nr_psc_entries;
+			break;
+		case 'C':
+			param = &nr_cpus;
+			break;
+		case 'I':
+			param = &ipi_cycles;
+			break;
+		case 'N':
+			param = &nr_nodes;
+			break;
+		case 'm':
+			if (!__parse_numa_policy(optarg)) {
+				fprintf(stderr, "Unknown NUMA policy %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'L':
+			param = &remote_access_cycles;
+			break;
+		case 'R':
+			restore_from = optarg;
+			break;
+		case 'c':
+			convert_to = optarg;
+			break;
+		case 'o':
+			if (!__parse_output_mode(optarg)) {
+				fprintf(stderr, "Unknown output mode %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			if (strcmp(optarg, "text") && strcmp(optarg, "json")) {
+				fprintf(stderr, "Unknown statistics format %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			summary = optarg;
+			break;
+		case 'r':
+			if (!(policy = find_replacement_policy(optarg))) {
+				fprintf(stderr, "Unknown replacement policy %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'x':
+			param = &nr_swap_slots;
+			break;
+		case 'd':
+			demand_paging = true;
+			break;
+		case 'W':
+			param = &profile_window;
+			break;
+		case 'k':
+			param = &scan_period;
+			break;
+		case 'M':
+			param = &merge_period;
+			break;
+		case 'F':
+			param = &prefetch_window;
+			break;
+		case 'B':
+			prefetch_async = true;
+			break;
 		case 'h':
 		default:
 			__print_usage(argv[0]);
 			return EXIT_FAILURE;
 		}
+
+		if (param && !__parse_number(optarg, param)) {
+			fprintf(stderr, "Invalid number %s for -%c\n", optarg, opt);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (restore_from && !load_checkpoint_geometry(restore_from)) {
+		fprintf(stderr, "No checkpoint %s\n", restore_from);
+		return EXIT_FAILURE;
+	}
+
+	if (!__setup_geometry()) {
+		return EXIT_FAILURE;
 	}
 
 	if (verbose && !argv[optind]) {
@@ -423,7 +1804,13 @@ int main(int argc, char * argv[])
 		printf("***************************************************************************\n");
 	}
 
-	if (argv[optind]) {
+	if (argv[optind] && !convert_to && is_trace_file(argv[optind])) {
+		if (!map_trace(&trace, argv[optind])) {
+			fprintf(stderr, "Unable to map trace %s\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+		verbose = false;
+	} else if (argv[optind]) {
 		if (verbose) printf("Use file \"%s\" for input.\n", argv[optind]);
 
 		input = fopen(argv[optind], "r");
@@ -436,14 +1823,48 @@ int main(int argc, char * argv[])
 		if (verbose) printf("Use stdin for input.\n");
 	}
 
+	if (convert_to) {
+		bool converted = __convert_trace(input, convert_to);
+
+		if (input != stdin) fclose(input);
+		return converted ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	if (verbose) {
 		printf("Type 'help' or '?' for help.\n\n");
 		printf(">> ");
 	}
 
-	__do_simulation(input);
+	__init_system();
+
+	if (restore_from && !restore_checkpoint(restore_from)) {
+		return EXIT_FAILURE;
+	}
+
+	if (output_mode == OUTPUT_BUFFERED) {
+		/* Flushed when the buffer is full, or on exit */
+		output_buffer = malloc(OUTPUT_BUFFER_SIZE);
+		setvbuf(stderr, output_buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+	}
 
-	if (input != stdin) fclose(input);
+	if (trace.addr) {
+		__replay_trace(&trace);
+		unmap_trace(&trace);
+	} else {
+		__do_simulation(input);
+		if (input != stdin) fclose(input);
+	}
+
+	if (summary) {
+		/* Keep the summary after the results of the memory operations */
+		fflush(stderr);
+		print_stats(stdout, strcmp(summary, "json") ? STATS_TEXT : STATS_JSON);
+	}
+	if (profile_window) {
+		fflush(stderr);
+		print_profile(stdout, summary && strcmp(summary, "json") == 0 ?
+				STATS_JSON : STATS_TEXT);
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -15,54 +15,340 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdint.h>
+
 #include "types.h"
 
+/**
+ * Memory geometry of the system. They are configured at startup by the
+ * command line options, and remain unchanged during the simulation.
+ */
+extern unsigned int nr_pageframes;
+extern unsigned int ptes_per_page_shift;
+extern unsigned int nr_pt_levels;
+extern unsigned int nr_tlb_entries;
+extern unsigned int nr_tlb_ways;
+extern unsigned int tlb_sets_shift;
+extern unsigned int nr_huge_tlb_entries;
+extern unsigned int nr_stlb_entries;
+extern unsigned int nr_stlb_ways;
+extern unsigned int stlb_sets_shift;
+extern unsigned int nr_cpus;
+extern unsigned int nr_nodes;
+
 /* The number of physical page frames of the system */
-#define NR_PAGEFRAMES	128
+#define NR_PAGEFRAMES	nr_pageframes
 
 /* The number of PTEs in a page */
-#define PTES_PER_PAGE_SHIFT	4
-#define NR_PTES_PER_PAGE    (1 << PTES_PER_PAGE_SHIFT)
+#define PTES_PER_PAGE_SHIFT	ptes_per_page_shift
+#define NR_PTES_PER_PAGE    (1U << PTES_PER_PAGE_SHIFT)
+#define PTE_INDEX_MASK		(NR_PTES_PER_PAGE - 1)
+
+/* The number of VPNs that the page table can translate */
+#define NR_VPNS		(1UL << (PTES_PER_PAGE_SHIFT * nr_pt_levels))
+
+/* A huge page covers the VPNs translated by an outer page table entry */
+#define HUGE_PAGE_SHIFT		(PTES_PER_PAGE_SHIFT * (nr_pt_levels - 1))
+#define NR_HUGE_PAGE_PAGES	(1U << HUGE_PAGE_SHIFT)
+
+/**
+ * CPUs of the system. CPUs are identified by the bits in a 64-bit mask
+ */
+#define MAX_CPUS	64
+#define cpu_bit(cpu)	(1ULL << (cpu))
+
+/**
+ * Memory nodes of the system. The page frames are split into NR_NODES nodes
+ * of consecutive page frames, and the last node takes the remainder. CPU
+ * @cpu is on node (@cpu % NR_NODES), and the accesses from the CPU to the
+ * page frames on the other nodes are remote.
+ */
+#define MAX_NODES	16
+#define NR_NODES	nr_nodes
+#define FRAMES_PER_NODE	(NR_PAGEFRAMES / NR_NODES)
+
+static inline unsigned int pfn_to_node(unsigned int pfn)
+{
+	unsigned int node;
+
+	if (NR_NODES == 1) return 0;
+
+	node = pfn / FRAMES_PER_NODE;
+	return node < NR_NODES ? node : NR_NODES - 1;
+}
+
+static inline unsigned int cpu_to_node(unsigned int cpu)
+{
+	return cpu % NR_NODES;
+}
+
+/**
+ * Results of each memory operation are printed to stderr as they are
+ * processed by default. They can be buffered in the user space and flushed
+ * in bulk, or be suppressed altogether. Explicit commands such as show and
+ * pages print their results regardless of the mode.
+ */
+enum output_mode {
+	OUTPUT_UNBUFFERED = 0,
+	OUTPUT_BUFFERED,
+	OUTPUT_NONE,
+};
+extern enum output_mode output_mode;
+
+#define pr_result(...) do {	\
+	if (output_mode != OUTPUT_NONE) fprintf(stderr, __VA_ARGS__);	\
+} while (0)
 
 #define RW_READ  0x01
 #define RW_WRITE 0x02
 
 /**
- * 2-level page table abstraction
+ * Multi-level page table abstraction
+ */
+/**
+ * PTE is packed into a 32-bit word like the real hardware does. The lower
+ * PTE_PFN_SHIFT bits hold the flags and the rest holds the page frame number.
  */
 struct pte {
-	bool valid;
-	bool writable;
-	unsigned int pfn;
-	unsigned int private;	/* May use to backup something ;-) */
+	unsigned int val;
 };
 
+#define PTE_VALID		0x01
+#define PTE_WRITABLE	0x02
+#define PTE_ACCESSED	0x08	/* Set by the MMU on the page table walks */
+#define PTE_DIRTY		0x10	/* Set by the MMU on the writes */
+#define PTE_HUGE		0x80	/* Maps NR_HUGE_PAGE_PAGES page frames from the PFN */
+
+#define PTE_PFN_SHIFT	8
+#define PTE_FLAGS_MASK	((1U << PTE_PFN_SHIFT) - 1)
+#define MAX_PAGEFRAMES	(1U << (32 - PTE_PFN_SHIFT))
+
+static inline bool pte_none(struct pte *pte)
+{
+	return pte->val == 0;
+}
+
+static inline bool pte_valid(struct pte *pte)
+{
+	return !!(pte->val & PTE_VALID);
+}
+
+static inline bool pte_writable(struct pte *pte)
+{
+	return !!(pte->val & PTE_WRITABLE);
+}
+
+static inline bool pte_huge(struct pte *pte)
+{
+	return !!(pte->val & PTE_HUGE);
+}
+
+static inline bool pte_accessed(struct pte *pte)
+{
+	return !!(pte->val & PTE_ACCESSED);
+}
+
+static inline bool pte_dirty(struct pte *pte)
+{
+	return !!(pte->val & PTE_DIRTY);
+}
+
+static inline unsigned int pte_pfn(struct pte *pte)
+{
+	return pte->val >> PTE_PFN_SHIFT;
+}
+
+static inline unsigned int pte_flags(struct pte *pte)
+{
+	return pte->val & PTE_FLAGS_MASK;
+}
+
+static inline void set_pte(struct pte *pte, unsigned int pfn, unsigned int flags)
+{
+	pte->val = (pfn << PTE_PFN_SHIFT) | (flags & PTE_FLAGS_MASK);
+}
+
+static inline void clear_pte(struct pte *pte)
+{
+	pte->val = 0;
+}
+
+static inline void pte_set_flags(struct pte *pte, unsigned int flags)
+{
+	pte->val |= flags;
+}
+
+static inline void pte_clear_flags(struct pte *pte, unsigned int flags)
+{
+	pte->val &= ~flags;
+}
+
+/**
+ * Page directory at each level. Directories at level 0 hold PTEs, and those
+ * at the upper levels point to the directories of the next lower level.
+ */
 struct pte_directory {
-	struct pte ptes[NR_PTES_PER_PAGE];
+	unsigned int nr_used;	/* The number of entries in use */
+	unsigned int refcount;	/* The number of slots pointing to this directory */
+	union {
+		struct pte ptes[0];	/* NR_PTES_PER_PAGE entries */
+		struct pte_directory *dirs[0];
+	};
 };
 
 struct pagetable {
-	struct pte_directory *outer_ptes[NR_PTES_PER_PAGE];
+	struct pte_directory **outer_ptes;	/* NR_PTES_PER_PAGE entries */
+	struct pte *huge_ptes;	/* NR_PTES_PER_PAGE entries. NULL if no huge page */
+};
+
+#define PTE_DIRECTORY_SIZE(level)	\
+	(sizeof(struct pte_directory) + NR_PTES_PER_PAGE * \
+	 ((level) ? sizeof(struct pte_directory *) : sizeof(struct pte)))
+
+
+/**
+ * Virtual memory area of the pages in [@start, @end) with the same
+ * permission. The areas of a process are in a red-black tree. See vma.h
+ */
+struct vma {
+	unsigned int start;
+	unsigned int end;
+	unsigned int prot;	/* RW_READ, or RW_READ | RW_WRITE */
+
+	bool red;
+	struct vma *parent;
+	struct vma *left;
+	struct vma *right;
+};
+
+struct vma_tree {
+	struct vma *root;	/* NULL if no area */
+	unsigned int nr_vmas;
 };
 
 
 /**
  * Simplified PCB
  */
+/**
+ * Page faults of a process seen by the prefetcher. See prefetch.h
+ */
+struct prefetch_state {
+	bool touched;		/* @last_vpn is valid */
+	unsigned int last_vpn;	/* The new page touched last */
+	int stride;		/* From the one touched before @last_vpn */
+
+	/* Window of the swapped-out pages to read in the background */
+	unsigned int pending_vpn;
+	int pending_stride;
+	unsigned int nr_pending;
+};
+
 struct process {
 	unsigned int pid;
+	unsigned int asid;	/* Address space ID. Unique even if pids collide */
 
 	struct pagetable pagetable;
+	struct vma_tree vmas;	/* Pages allocated to the process */
 
 	struct list_head list;  /* List head to chain processes on the system */
+
+	struct hlist_node hash;	/* Hash link to find the process in @processes */
+	unsigned long ready_seq;	/* When the process is put into @processes */
+
+	uint64_t cpumask;	/* CPUs that may cache the translations of the process */
+
+	unsigned int home_node;	/* Node of the CPU the process is forked on */
+	unsigned int next_node;	/* To allocate from in the interleave policy */
+
+	struct prefetch_state prefetch;
 };
 
 
 struct tlb_entry {
 	bool valid;
+	bool dirty;		/* The PTE is known to be dirty */
+	bool referenced;	/* For the replacement policy */
+	unsigned int asid;	/* Address space the translation belongs to */
 	unsigned int vpn;
 	unsigned int pfn;
+	unsigned long stamp;	/* Insertion order for FIFO replacement */
+	unsigned long rank;	/* For the replacement policy */
 };
 
-#define NR_TLB_ENTRIES	(1 << (PTES_PER_PAGE_SHIFT * 2))
+/**
+ * TLB is organized as NR_TLB_SETS sets of NR_TLB_WAYS entries each. A VPN
+ * is cached in the set indexed by its lower bits, and the entries in a set
+ * are replaced in the FIFO manner unless another policy is chosen (see
+ * tlb.h). The number of sets is a power of two. Entries cache the dirty bit
+ * of the PTE, and a write through a clean entry walks the page table to set
+ * the bit in the PTE.
+ */
+#define NR_TLB_ENTRIES	nr_tlb_entries
+#define NR_TLB_WAYS		nr_tlb_ways
+#define NR_TLB_SETS		(1U << tlb_sets_shift)
+
+#define TLB_SET_OF(vpn)	((vpn) & (NR_TLB_SETS - 1))
+
+/**
+ * Second-level TLB (STLB) behind the TLB above, organized likewise. It is
+ * looked up when neither the TLB nor the huge page TLB has the translation,
+ * and its hit fills the TLB. The translations from page table walks are
+ * inserted into both. There is no STLB if NR_STLB_ENTRIES is 0.
+ */
+#define NR_STLB_ENTRIES	nr_stlb_entries
+#define NR_STLB_WAYS	nr_stlb_ways
+#define NR_STLB_SETS	(1U << stlb_sets_shift)
+
+#define STLB_SET_OF(vpn)	((vpn) & (NR_STLB_SETS - 1))
+
+/* Insertion counter to stamp the TLB entries */
+extern unsigned long tlb_clock;
+
+/**
+ * Huge pages are cached in a separate, fully associative TLB of
+ * NR_HUGE_TLB_ENTRIES entries. The entries hold the huge page number
+ * (VPN >> HUGE_PAGE_SHIFT) and the first page frame of the huge page.
+ */
+#define NR_HUGE_TLB_ENTRIES	nr_huge_tlb_entries
+
+/**
+ * Paging-structure cache of the MMU. It caches the leaf directories of the
+ * address spaces by the VPN bits above the leaf index, so that page table
+ * walks on TLB misses skip the upper levels. Only the directories not shared
+ * with other page tables are cached, and the entries are replaced in the
+ * FIFO manner. The entries are invalidated along with the TLB entries.
+ */
+extern unsigned int nr_psc_entries;
+
+struct psc_entry {
+	bool valid;
+	unsigned int asid;
+	unsigned int index;		/* VPN >> PTES_PER_PAGE_SHIFT */
+	struct pte_directory *pd;
+	unsigned long stamp;
+};
+
+/* Insertion counter to stamp the paging-structure cache entries */
+extern unsigned long psc_clock;
+
+/**
+ * Simulated CPUs. Each CPU runs its own process with its own TLBs and
+ * paging-structure cache. The state of the CPU running the trace is in
+ * @current, @ptbr, and so on, and is saved to @cpus[@this_cpu] by
+ * switch_cpu() when the trace moves to another CPU.
+ */
+struct cpu {
+	struct process *current;	/* NULL if the CPU is idle */
+	struct pagetable *ptbr;
+	struct tlb_entry *tlb;
+	struct tlb_entry *huge_tlb;
+	struct tlb_entry *stlb;
+	struct psc_entry *psc;
+};
+
+extern struct cpu *cpus;
+extern unsigned int this_cpu;
+
+void switch_cpu(unsigned int cpu);
 #endif
@@ -0,0 +1,402 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "list_head.h"
+#include "vm.h"
+#include "pagetable.h"
+#include "slab.h"
+#include "vma.h"
+
+static struct slab_cache vma_cache = SLAB_CACHE_INIT("vma", sizeof(struct vma));
+
+static inline bool __red(struct vma *vma)
+{
+	return vma && vma->red;
+}
+
+/* Put @new in place of @old under the parent of @old */
+static void __replace_child(struct vma_tree *tree, struct vma *old,
+		struct vma *new)
+{
+	if (!old->parent) {
+		tree->root = new;
+	} else if (old == old->parent->left) {
+		old->parent->left = new;
+	} else {
+		old->parent->right = new;
+	}
+	if (new) new->parent = old->parent;
+}
+
+static void __rotate_left(struct vma_tree *tree, struct vma *x)
+{
+	struct vma *y = x->right;
+
+	x->right = y->left;
+	if (y->left) y->left->parent = x;
+	__replace_child(tree, x, y);
+	y->left = x;
+	x->parent = y;
+}
+
+static void __rotate_right(struct vma_tree *tree, struct vma *x)
+{
+	struct vma *y = x->left;
+
+	x->left = y->right;
+	if (y->right) y->right->parent = x;
+	__replace_child(tree, x, y);
+	y->right = x;
+	x->parent = y;
+}
+
+static void __insert_vma(struct vma_tree *tree, struct vma *vma)
+{
+	struct vma **link = &tree->root;
+	struct vma *parent = NULL;
+
+	while (*link) {
+		parent = *link;
+		link = vma->start < parent->start ? &parent->left : &parent->right;
+	}
+	vma->parent = parent;
+	vma->left = vma->right = NULL;
+	vma->red = true;
+	*link = vma;
+	tree->nr_vmas++;
+
+	/* A red node has a red parent. The grandparent is black */
+	while (__red(vma->parent)) {
+		struct vma *p = vma->parent;
+		struct vma *g = p->parent;
+
+		if (p == g->left) {
+			struct vma *uncle = g->right;
+
+			if (__red(uncle)) {
+				p->red = uncle->red = false;
+				g->red = true;
+				vma = g;
+				continue;
+			}
+			if (vma == p->right) {
+				__rotate_left(tree, p);
+				vma = p;
+				p = vma->parent;
+			}
+			p->red = false;
+			g->red = true;
+			__rotate_right(tree, g);
+		} else {
+			struct vma *uncle = g->left;
+
+			if (__red(uncle)) {
+				p->red = uncle->red = false;
+				g->red = true;
+				vma = g;
+				continue;
+			}
+			if (vma == p->left) {
+				__rotate_right(tree, p);
+				vma = p;
+				p = vma->parent;
+			}
+			p->red = false;
+			g->red = true;
+			__rotate_left(tree, g);
+		}
+	}
+	tree->root->red = false;
+}
+
+/* @x under @parent lacks a black node on its paths after an erase */
+static void __erase_fixup(struct vma_tree *tree, struct vma *x,
+		struct vma *parent)
+{
+	while (x != tree->root && !__red(x)) {
+		if (x == parent->left) {
+			struct vma *w = parent->right;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				__rotate_left(tree, parent);
+				w = parent->right;
+			}
+			if (!__red(w->left) && !__red(w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (!__red(w->right)) {
+				w->left->red = false;
+				w->red = true;
+				__rotate_right(tree, w);
+				w = parent->right;
+			}
+			w->red = parent->red;
+			parent->red = false;
+			w->right->red = false;
+			__rotate_left(tree, parent);
+		} else {
+			struct vma *w = parent->left;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				__rotate_right(tree, parent);
+				w = parent->left;
+			}
+			if (!__red(w->left) && !__red(w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (!__red(w->left)) {
+				w->right->red = false;
+				w->red = true;
+				__rotate_left(tree, w);
+				w = parent->left;
+			}
+			w->red = parent->red;
+			parent->red = false;
+			w->left->red = false;
+			__rotate_right(tree, parent);
+		}
+		x = tree->root;
+	}
+	if (x) x->red = false;
+}
+
+/**
+ * Unlink @vma from @tree and free it. The nodes are relinked rather than
+ * having their areas moved, so other areas remain where they are
+ */
+static void __erase_vma(struct vma_tree *tree, struct vma *vma)
+{
+	struct vma *x, *parent;
+	bool red = vma->red;
+
+	if (!vma->left || !vma->right) {
+		x = vma->left ? vma->left : vma->right;
+		parent = vma->parent;
+		__replace_child(tree, vma, x);
+	} else {
+		struct vma *next = vma->right;
+
+		while (next->left) next = next->left;
+
+		/* @next takes the place and the color of @vma */
+		red = next->red;
+		x = next->right;
+		if (next->parent == vma) {
+			parent = next;
+		} else {
+			parent = next->parent;
+			__replace_child(tree, next, x);
+			next->right = vma->right;
+			next->right->parent = next;
+		}
+		__replace_child(tree, vma, next);
+		next->left = vma->left;
+		next->left->parent = next;
+		next->red = vma->red;
+	}
+	tree->nr_vmas--;
+	slab_free(&vma_cache, vma);
+
+	if (!red) __erase_fixup(tree, x, parent);
+}
+
+/* The last area that starts at or before @vpn */
+static struct vma *__floor_vma(struct vma_tree *tree, unsigned int vpn)
+{
+	struct vma *vma = tree->root;
+	struct vma *floor = NULL;
+
+	while (vma) {
+		if (vma->start <= vpn) {
+			floor = vma;
+			vma = vma->right;
+		} else {
+			vma = vma->left;
+		}
+	}
+	return floor;
+}
+
+struct vma *find_vma(struct vma_tree *tree, unsigned int vpn)
+{
+	struct vma *vma = __floor_vma(tree, vpn);
+
+	return vma && vpn < vma->end ? vma : NULL;
+}
+
+struct vma *find_vma_intersection(struct vma_tree *tree, unsigned int start,
+		unsigned int end)
+{
+	struct vma *vma = __floor_vma(tree, start);
+
+	if (vma && start < vma->end) return vma;
+
+	vma = vma ? next_vma(vma) : first_vma(tree);
+	return vma && vma->start < end ? vma : NULL;
+}
+
+struct vma *first_vma(struct vma_tree *tree)
+{
+	struct vma *vma = tree->root;
+
+	if (!vma) return NULL;
+
+	while (vma->left) vma = vma->left;
+	return vma;
+}
+
+struct vma *next_vma(struct vma *vma)
+{
+	if (vma->right) {
+		vma = vma->right;
+		while (vma->left) vma = vma->left;
+		return vma;
+	}
+	while (vma->parent && vma == vma->parent->right) vma = vma->parent;
+	return vma->parent;
+}
+
+void map_vmas(struct vma_tree *tree, unsigned int start, unsigned int end,
+		unsigned int prot)
+{
+	struct vma *prev = __floor_vma(tree, start);
+	struct vma *next = prev ? next_vma(prev) : first_vma(tree);
+	struct vma *vma;
+
+	assert(start < end && !find_vma_intersection(tree, start, end));
+
+	if (prev && (prev->end != start || prev->prot != prot)) prev = NULL;
+	if (next && (next->start != end || next->prot != prot)) next = NULL;
+
+	if (prev && next) {
+		prev->end = next->end;
+		__erase_vma(tree, next);
+	} else if (prev) {
+		prev->end = end;
+	} else if (next) {
+		/* Still ordered, as nothing is in between */
+		next->start = start;
+	} else {
+		vma = slab_alloc(&vma_cache);
+		vma->start = start;
+		vma->end = end;
+		vma->prot = prot;
+		__insert_vma(tree, vma);
+	}
+}
+
+void unmap_vmas(struct vma_tree *tree, unsigned int start, unsigned int end)
+{
+	struct vma *vma = find_vma_intersection(tree, start, end);
+
+	while (vma && vma->start < end) {
+		struct vma *next = next_vma(vma);
+
+		if (vma->start < start && end < vma->end) {
+			struct vma *tail = slab_alloc(&vma_cache);
+
+			tail->start = end;
+			tail->end = vma->end;
+			tail->prot = vma->prot;
+			vma->end = start;
+			__insert_vma(tree, tail);
+			return;
+		}
+
+		if (vma->start < start) {
+			vma->end = start;
+		} else if (end < vma->end) {
+			vma->start = end;
+		} else {
+			__erase_vma(tree, vma);
+		}
+		vma = next;
+	}
+}
+
+static struct vma *__copy_vma(struct vma *vma, struct vma *parent)
+{
+	struct vma *copy;
+
+	if (!vma) return NULL;
+
+	copy = slab_alloc(&vma_cache);
+	*copy = *vma;
+	copy->parent = parent;
+	copy->left = __copy_vma(vma->left, copy);
+	copy->right = __copy_vma(vma->right, copy);
+	return copy;
+}
+
+void copy_vmas(struct vma_tree *dst, struct vma_tree *src)
+{
+	/* Same shape and colors, so no need to rebalance */
+	dst->root = __copy_vma(src->root, NULL);
+	dst->nr_vmas = src->nr_vmas;
+}
+
+static void __free_vma(struct vma *vma)
+{
+	if (!vma) return;
+
+	__free_vma(vma->left);
+	__free_vma(vma->right);
+	slab_free(&vma_cache, vma);
+}
+
+void free_vmas(struct vma_tree *tree)
+{
+	__free_vma(tree->root);
+	tree->root = NULL;
+	tree->nr_vmas = 0;
+}
+
+bool vma_unpopulated(struct vma_tree *tree, struct pagetable *pt,
+		unsigned int vpn)
+{
+	struct pte *pte;
+
+	if (lookup_huge_pte(pt, vpn)) return false;
+
+	pte = lookup_pte(pt, vpn, NULL);
+	if (pte && !pte_none(pte)) return false;
+
+	return find_vma(tree, vpn) != NULL;
+}
+
+unsigned long nr_vmas_in_use(void)
+{
+	return vma_cache.nr_active;
+}
+
+void destroy_vmas(void)
+{
+	destroy_slab_cache(&vma_cache);
+}
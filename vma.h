@@ -0,0 +1,140 @@
+/**********************************************************************
+ * Copyright (c) 2020-2022
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+
+#ifndef __VMA_H__
+#define __VMA_H__
+
+#include "types.h"
+#include "vm.h"
+
+/**
+ * Virtual memory areas of the processes. Pages allocated to a process are
+ * kept as the areas of the pages in a row with the same permission, and
+ * the page fault handler looks up the area of the faulting page for the
+ * permission instead of keeping it in each PTE. Adjacent areas of the same
+ * permission are merged, and freeing the pages in the middle of an area
+ * splits the area.
+ *
+ * The areas of a process do not overlap, and are kept in a red-black tree
+ * ordered by their start, so that the area covering a page is found in
+ * O(log n). The tree nodes are embedded in struct vma, and are allocated
+ * from a slab cache. Forked processes get copies of the trees of their
+ * parents.
+ *
+ * A page in an area is not necessarily mapped by the page table. The pages
+ * allocated on demand have no PTE until they are accessed for the first
+ * time.
+ */
+
+/**
+ * Permission of the area for the pages allocated for @rw. The pages are
+ * writable only if they are allocated for both read and write
+ */
+static inline unsigned int vma_prot(unsigned int rw)
+{
+	return rw == (RW_READ | RW_WRITE) ? rw : RW_READ;
+}
+
+static inline bool vma_writable(struct vma *vma)
+{
+	return vma->prot == (RW_READ | RW_WRITE);
+}
+
+/**
+ * find_vma(@tree, @vpn)
+ *
+ * RETURN
+ *   The area covering @vpn in @tree
+ *   NULL if @vpn is not in any area
+ */
+struct vma *find_vma(struct vma_tree *tree, unsigned int vpn);
+
+/**
+ * find_vma_intersection(@tree, @start, @end)
+ *
+ * RETURN
+ *   The first area in @tree that overlaps the pages in [@start, @end)
+ *   NULL if no area overlaps them
+ */
+struct vma *find_vma_intersection(struct vma_tree *tree, unsigned int start,
+		unsigned int end);
+
+/**
+ * first_vma(@tree)/next_vma(@vma)
+ *
+ * RETURN
+ *   The areas in the ascending order of the pages. NULL after the last one
+ */
+struct vma *first_vma(struct vma_tree *tree);
+struct vma *next_vma(struct vma *vma);
+
+/**
+ * map_vmas(@tree, @start, @end, @prot)
+ *
+ * DESCRIPTION
+ *   Add the pages in [@start, @end) to @tree with @prot, which is RW_READ or
+ *   RW_READ | RW_WRITE. The pages should not be in any area of @tree. The
+ *   areas adjacent to them are extended if they are of @prot.
+ */
+void map_vmas(struct vma_tree *tree, unsigned int start, unsigned int end,
+		unsigned int prot);
+
+/**
+ * unmap_vmas(@tree, @start, @end)
+ *
+ * DESCRIPTION
+ *   Remove the pages in [@start, @end) from the areas of @tree. The areas
+ *   are trimmed or split as needed.
+ */
+void unmap_vmas(struct vma_tree *tree, unsigned int start, unsigned int end);
+
+/**
+ * copy_vmas(@dst, @src)/free_vmas(@tree)
+ *
+ * DESCRIPTION
+ *   Make @dst, which is empty, a copy of @src on fork. Release all areas of
+ *   @tree on exit.
+ */
+void copy_vmas(struct vma_tree *dst, struct vma_tree *src);
+void free_vmas(struct vma_tree *tree);
+
+/**
+ * vma_unpopulated(@tree, @pt, @vpn)
+ *
+ * RETURN
+ *   @true if @vpn is in an area of @tree, but is not mapped by @pt yet
+ */
+bool vma_unpopulated(struct vma_tree *tree, struct pagetable *pt,
+		unsigned int vpn);
+
+/**
+ * nr_vmas_in_use()
+ *
+ * RETURN
+ *   The number of areas of all processes
+ */
+unsigned long nr_vmas_in_use(void);
+
+/**
+ * destroy_vmas()
+ *
+ * DESCRIPTION
+ *   Drop the areas of all processes, e.g., on restoring a checkpoint. The
+ *   trees of the processes should not be used any longer.
+ */
+void destroy_vmas(void);
+
+#endif